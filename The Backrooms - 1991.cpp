@@ -4,14 +4,42 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <time.h> // used to seed RNG
-#include <stdlib.h> // for rand function
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h> // memcpy
+#include <stdio.h> // snprintf
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory> // unique_ptr
+#include <charconv> // from_chars
+#include <stdint.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h> // SSE2, used by the autotiler
+#endif
+#include <random> // random_device, for new world seeds
+#include <time.h>
+#include <stdlib.h> // atoi, strtoull
 #include <math.h> // GCC doesn't incluse by default
 
 using namespace std;
 
 #include <filesystem>
 namespace fs = std::filesystem;
+#ifdef _WIN32 // memory-mapped world archive
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <SFML/Graphics.hpp>
 
 // Developer Settings
@@ -20,7 +48,8 @@ bool noClip = false;
 // Game variables
 sf::Vector2f screenPos[4], pPos;
 const sf::Vector2f chunkOffset(-8.f, -24.f);
-sf::Vector2i chunk;
+typedef sf::Vector2<int64_t> ChunkCoord; // 64-bit so endless maps never run out of chunks
+ChunkCoord chunk;
 
 // Player Stats
 float moveSpeed = 1.3;
@@ -36,6 +65,548 @@ const int solidWallId = 16;
 int mapSize = 7; // number of 64x64 chunks per axis. Use odd number for symmetric maps.
 int mapDensity = 20; // number of rectangular rooms per chunk
 int doorFreq = 15; // percent chance of a door generating at a given position
+uint64_t worldSeed = 0; // chunks are generated from this plus their own coordinates
+bool fixedSeed = false; // --seed N regenerates the same map instead of picking a new seed
+int genThreads = 0; // threads generating chunks, 0 = one per core (--gen-threads N)
+bool exportTextChunks = false; // also save chunks as editable text (--text-chunks)
+size_t chunkCacheBudget = 8 << 20; // bytes of decoded chunks kept in memory, enough for a whole Large map (--chunk-cache MB)
+enum chunkCodecs { codecRaw, codecRunLZ };
+uint8_t chunkCodec = codecRunLZ; // codec for new maps; an existing map keeps its own (--raw-chunks for uncompressed)
+
+// Background map generation, shown by mapGenScreen
+thread genThread;
+atomic<bool> genRunning(false), genCancel(false), genSaved(false); // genSaved: the run finished and replaced the map
+atomic<int> genPhase(0), genChunksDone(0); // phase is the line of Text/MapGen.txt being worked on
+vector<string> genText;
+sf::Clock genClock;
+bool endlessMap = false; // no edge: chunks are generated from the seed when first needed, and only visited ones are saved
+const int mapOptions[3] = { 4, 3, 3 }; // choices for each setting on the game setup screen
+
+// Counter-based random numbers (Philox4x32-10): every value is a pure function of (seed, purpose, chunk, index),
+// so any single draw can be evaluated directly, from any thread and in any order, with the same result everywhere
+enum rngPurposes { rngRooms, rngDoors, rngEdgeDoorsH, rngEdgeDoorsV, rngEnemies };
+struct RandomStream {
+    uint64_t seed;
+    uint32_t purpose;
+    uint64_t chunkHash;
+    uint32_t next = 0; // index of the next sequential draw
+    uint32_t cache[4], cachedBlock = UINT32_MAX; // Philox block the sequential draws are currently taken from
+
+    RandomStream(uint64_t seed, int purpose, ChunkCoord chunk) : seed(seed), purpose(purpose) {
+        // Fold both 64-bit coordinates into the counter's upper half
+        uint64_t z = (uint64_t)chunk.x * 0x9E3779B97F4A7C15ull ^ (uint64_t)chunk.y;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        chunkHash = z ^ (z >> 31);
+    }
+
+    // Philox block number blockIndex: draws 4 * blockIndex to 4 * blockIndex + 3 of this stream
+    void block(uint32_t blockIndex, uint32_t out[4]) const {
+        out[0] = blockIndex;
+        out[1] = purpose;
+        out[2] = (uint32_t)chunkHash;
+        out[3] = (uint32_t)(chunkHash >> 32);
+        philox(out, seed);
+    }
+
+    // Draw number index of this stream: word index % 4 of Philox block index / 4
+    uint32_t at(uint32_t index) const {
+        uint32_t words[4];
+        block(index / 4, words);
+        return words[index % 4];
+    }
+    int operator()(int n) {
+        if (next / 4 != cachedBlock) {
+            cachedBlock = next / 4;
+            block(cachedBlock, cache);
+        }
+        return cache[next++ % 4] % n;
+    }
+
+    // Bulk draws: one Philox block per four words, and the blocks are independent, so the whole-block loop has no carried state to stop it vectorizing
+    void fill(uint32_t* out, uint32_t first, uint32_t count) const {
+        uint32_t words[4];
+        uint32_t i = 0;
+
+        // Words before the first block boundary
+        if (first % 4 != 0 && count > 0) {
+            block(first / 4, words);
+            for (; i < count && (first + i) % 4 != 0; i++) out[i] = words[(first + i) % 4];
+        }
+        for (; i + 4 <= count; i += 4) {
+            block((first + i) / 4, words);
+            memcpy(out + i, words, sizeof(words));
+        }
+        // Words after the last block boundary
+        if (i < count) {
+            block((first + i) / 4, words);
+            for (uint32_t w = 0; i < count; i++, w++) out[i] = words[w];
+        }
+    }
+
+    static void philox(uint32_t ctr[4], uint64_t key) {
+        uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0];
+            uint64_t p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+            uint32_t c1 = ctr[1], c3 = ctr[3];
+
+            ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            ctr[1] = (uint32_t)p1;
+            ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            ctr[3] = (uint32_t)p0;
+
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+    }
+};
+
+// Tile grid shared by map generation, autotiling and saving: 8-bit tile IDs in one flat allocation,
+// stored chunk by chunk so every 64x64 chunk is a contiguous row-major block
+typedef uint8_t TileId;
+class TileGrid {
+private:
+    vector<TileId> tiles;
+    int chunksWide = 0;
+
+public:
+    TileGrid(int chunksWide, int chunksHigh) : tiles((size_t)chunksWide * chunksHigh * 64 * 64, 0), chunksWide(chunksWide) {}
+
+    TileId* chunk(int cx, int cy) {
+        return &tiles[((size_t)cy * chunksWide + cx) * 64 * 64];
+    }
+    size_t bytes() const {
+        return tiles.size() * sizeof(TileId);
+    }
+};
+
+// Wall tile for each neighbour mask (bit 0 left, 1 up, 2 right, 3 down)
+constexpr TileId wallTileLUT[16] = { 47, 34, 35, 43, 32, 33, 44, 39, 36, 46, 38, 42, 45, 41, 40, 37 };
+
+// Binary chunk record: a fixed header, then the tiles either exactly as they're laid out in memory (codecRaw)
+// or packed as runs, back references and literals (codecRunLZ, see compressTiles).
+// PyxelEdit text chunks (Map/Map_x_y.dat) are still imported, and exported with --text-chunks.
+const char chunkMagic[4] = { 'B', 'R', 'C', 'K' };
+const uint16_t chunkVersion = 1;
+struct ChunkHeader {
+    char magic[4];
+    uint16_t version;
+    uint8_t tileBytes, width, height;
+    uint8_t codec = codecRaw;
+    uint8_t reserved[6] = { 0 };
+};
+static_assert(sizeof(ChunkHeader) == 16, "chunk header must stay 16 bytes");
+struct ChunkFile {
+    ChunkHeader header;
+    TileId tiles[64 * 64];
+};
+vector<uint8_t> encodeChunk(const TileId* walls, uint8_t codec);
+bool decodeChunk(const uint8_t* payload, size_t bytes, TileId* walls);
+
+// Read-only memory map of a whole file
+class MappedFile {
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); // the world archive is appended to while mapped
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        GetFileSizeEx(file, &size);
+        length = (size_t)size.QuadPart;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            length = (size_t)info.st_size;
+            void* view = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) bytes = (const uint8_t*)view;
+        }
+        ::close(fd); // the mapping keeps the file open
+#endif
+        if (!bytes) close();
+        return bytes != nullptr;
+    }
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap((void*)bytes, length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// World archive (Map/World.bra): the world settings, every chunk record, then an index of where each chunk is.
+// It's read through a read-only memory map, so reaching any chunk is a hash lookup and a copy with no file access.
+// Saves only ever append: new records and a new index go after the end of the file, then the header is rewritten to
+// point at them, so a crash or full disk part way through leaves the old header, index and records intact.
+const string worldFilename = "Map/World.bra";
+const char archiveMagic[4] = { 'B', 'R', 'W', 'A' };
+const uint16_t archiveVersion = 1;
+const uint64_t archiveCompactSize = 1 << 20; // smaller archives are never compacted
+struct ArchiveHeader {
+    char magic[4];
+    uint16_t version;
+    uint8_t endless, codec; // codec every chunk is written with
+    uint64_t seed;
+    int32_t size, density, doorFreq;
+    uint32_t chunkCount;
+    uint64_t indexOffset;
+};
+static_assert(sizeof(ArchiveHeader) == 40, "archive header must stay 40 bytes");
+struct ArchiveEntry {
+    int64_t x, y;
+    uint64_t offset;
+    uint32_t bytes, reserved;
+};
+static_assert(sizeof(ArchiveEntry) == 32, "archive index entries must stay 32 bytes");
+struct ChunkCoordHash {
+    size_t operator()(ChunkCoord c) const {
+        return hash<uint64_t>()((uint64_t)c.x * 0x9E3779B97F4A7C15ull ^ (uint64_t)c.y);
+    }
+};
+
+class WorldArchive {
+private:
+    string path;
+    ArchiveHeader head = {};
+    unordered_map<ChunkCoord, ArchiveEntry, ChunkCoordHash> index;
+    uint64_t fileEnd = 0; // end of the current index; anything after it is left over from a failed save
+    mutable MappedFile mapped; // covers the file as it was when mapped; remapped when a newer record is read
+    mutable mutex lock;
+
+    // Records and an index after fileEnd, then the header. Nothing the current header points at is touched.
+    bool append(const vector<ChunkCoord>& chunks, const vector<vector<uint8_t>>& payloads) {
+        fstream out(path, ios::in | ios::out | ios::binary);
+        unordered_map<ChunkCoord, ArchiveEntry, ChunkCoordHash> updated = index;
+        uint64_t end = fileEnd;
+
+        out.seekp(end);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            uint32_t bytes = (uint32_t)payloads[i].size();
+            updated[chunks[i]] = ArchiveEntry{ chunks[i].x, chunks[i].y, end, bytes, 0 };
+            out.write((const char*)payloads[i].data(), bytes);
+            end += bytes;
+        }
+
+        ArchiveHeader newHead = head;
+        vector<ArchiveEntry> entries = sortedEntries(updated);
+        newHead.chunkCount = (uint32_t)entries.size();
+        newHead.indexOffset = end;
+        out.write((const char*)entries.data(), entries.size() * sizeof(ArchiveEntry));
+        if (!out.flush()) return false; // the old header still stands
+
+        out.seekp(0);
+        out.write((const char*)&newHead, sizeof(newHead));
+        if (!out.flush()) return false;
+
+        head = newHead;
+        index.swap(updated);
+        fileEnd = end + entries.size() * sizeof(ArchiveEntry);
+        return true;
+    }
+    // The live records and the new ones into a fresh file, which then replaces the archive
+    bool compact(const vector<ChunkCoord>& chunks, const vector<vector<uint8_t>>& payloads) {
+        if (fileEnd > mapped.size() && !mapped.open(path)) return false;
+
+        unordered_map<ChunkCoord, bool, ChunkCoordHash> replaced;
+        for (ChunkCoord chunk : chunks) replaced[chunk] = true;
+
+        string tempFilename = path + ".tmp";
+        ofstream out(tempFilename, ios::binary | ios::trunc);
+        unordered_map<ChunkCoord, ArchiveEntry, ChunkCoordHash> updated;
+        uint64_t end = sizeof(head);
+
+        out.seekp(end);
+        for (const ArchiveEntry& entry : sortedEntries(index)) {
+            ChunkCoord chunk(entry.x, entry.y);
+            if (replaced.count(chunk)) continue;
+            updated[chunk] = ArchiveEntry{ entry.x, entry.y, end, entry.bytes, 0 };
+            out.write((const char*)mapped.data() + entry.offset, entry.bytes);
+            end += entry.bytes;
+        }
+        for (size_t i = 0; i < chunks.size(); i++) {
+            uint32_t bytes = (uint32_t)payloads[i].size();
+            updated[chunks[i]] = ArchiveEntry{ chunks[i].x, chunks[i].y, end, bytes, 0 };
+            out.write((const char*)payloads[i].data(), bytes);
+            end += bytes;
+        }
+
+        ArchiveHeader newHead = head;
+        vector<ArchiveEntry> entries = sortedEntries(updated);
+        newHead.chunkCount = (uint32_t)entries.size();
+        newHead.indexOffset = end;
+        out.write((const char*)entries.data(), entries.size() * sizeof(ArchiveEntry));
+        out.seekp(0);
+        out.write((const char*)&newHead, sizeof(newHead));
+        out.close();
+        error_code err;
+        if (!out) {
+            fs::remove(tempFilename, err);
+            return false;
+        }
+
+        mapped.close(); // Windows won't replace a mapped file
+        fs::rename(tempFilename, path, err);
+        if (err) {
+            fs::remove(tempFilename, err);
+            mapped.open(path);
+            return false;
+        }
+
+        head = newHead;
+        index.swap(updated);
+        fileEnd = end + entries.size() * sizeof(ArchiveEntry);
+        return mapped.open(path);
+    }
+    static vector<ArchiveEntry> sortedEntries(const unordered_map<ChunkCoord, ArchiveEntry, ChunkCoordHash>& entries) {
+        // Index in file order, so the same map always makes the same file
+        vector<ArchiveEntry> sorted;
+        sorted.reserve(entries.size());
+        for (auto& item : entries) sorted.push_back(item.second);
+        sort(sorted.begin(), sorted.end(), [](const ArchiveEntry& l, const ArchiveEntry& r) { return l.offset < r.offset; });
+        return sorted;
+    }
+
+public:
+    ~WorldArchive() { close(); }
+
+    bool open(string filename) {
+        lock_guard<mutex> guard(lock);
+        mapped.close();
+        index.clear();
+        path = filename;
+        if (!mapped.open(path)) return false;
+
+        if (mapped.size() < sizeof(head)) {
+            mapped.close();
+            return false;
+        }
+        memcpy(&head, mapped.data(), sizeof(head));
+        if (memcmp(head.magic, archiveMagic, 4) != 0 || head.version != archiveVersion
+            || head.indexOffset + (uint64_t)head.chunkCount * sizeof(ArchiveEntry) > mapped.size()) {
+            cout << "\nWarning: " << filename << " is not a version " << archiveVersion << " world archive.";
+            mapped.close();
+            return false;
+        }
+
+        // The index is the only part read up front; chunk records stay in the map until they're asked for
+        index.reserve(head.chunkCount);
+        for (uint32_t i = 0; i < head.chunkCount; i++) {
+            ArchiveEntry entry;
+            memcpy(&entry, mapped.data() + head.indexOffset + i * sizeof(entry), sizeof(entry));
+            if (entry.offset + entry.bytes <= head.indexOffset) index[ChunkCoord(entry.x, entry.y)] = entry;
+        }
+        fileEnd = head.indexOffset + (uint64_t)head.chunkCount * sizeof(ArchiveEntry);
+        return true;
+    }
+    bool create(string filename, const ArchiveHeader& header) {
+        lock_guard<mutex> guard(lock);
+        mapped.close();
+        index.clear();
+        path = filename;
+        head = header;
+        memcpy(head.magic, archiveMagic, 4);
+        head.version = archiveVersion;
+        head.chunkCount = 0;
+        head.indexOffset = sizeof(head);
+        fileEnd = sizeof(head);
+
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out.write((const char*)&head, sizeof(head))) return false;
+        out.close();
+        return mapped.open(path);
+    }
+    void close() {
+        lock_guard<mutex> guard(lock);
+        mapped.close();
+        index.clear();
+        path.clear();
+        fileEnd = 0;
+    }
+
+    bool isOpen() const {
+        lock_guard<mutex> guard(lock);
+        return mapped.data() != nullptr;
+    }
+    ArchiveHeader header() const {
+        lock_guard<mutex> guard(lock);
+        return head;
+    }
+    bool contains(ChunkCoord chunk) const {
+        lock_guard<mutex> guard(lock);
+        return index.count(chunk) > 0;
+    }
+    size_t chunkCount() const {
+        lock_guard<mutex> guard(lock);
+        return index.size();
+    }
+
+    bool read(ChunkCoord chunk, TileId* walls) const {
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(chunk);
+        if (it == index.end()) return false;
+        if (it->second.offset + it->second.bytes > mapped.size() && !mapped.open(path)) return false; // saved since the file was mapped
+
+        if (!decodeChunk(mapped.data() + it->second.offset, it->second.bytes, walls)) {
+            cout << "\nWarning: chunk (" << chunk.x << ", " << chunk.y << ") in " << path << " is damaged.";
+            return false;
+        }
+        return true;
+    }
+
+    // Appends, or once more than half the file would be records and indexes that have been replaced, rewrites it without them
+    bool write(const vector<ChunkCoord>& chunks, const vector<vector<uint8_t>>& payloads) {
+        lock_guard<mutex> guard(lock);
+        if (path.empty()) return false;
+
+        // Sizes after the save, assuming the chunks are all different
+        uint64_t live = sizeof(head), total = fileEnd;
+        size_t entries = index.size();
+        for (auto& item : index) live += item.second.bytes + sizeof(ArchiveEntry);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            auto it = index.find(chunks[i]);
+            if (it != index.end()) live -= it->second.bytes + sizeof(ArchiveEntry);
+            else entries++;
+            live += payloads[i].size() + sizeof(ArchiveEntry);
+            total += payloads[i].size();
+        }
+        total += entries * sizeof(ArchiveEntry);
+        if (total - live > live && total > archiveCompactSize) return compact(chunks, payloads);
+        return append(chunks, payloads);
+    }
+};
+WorldArchive world;
+
+// Asset pack (Assets.pack, baked with --bake-assets): every file in the asset folders in one memory-mapped file, with PNGs
+// stored already decoded to RGBA. Debug builds, or --loose-assets, use a loose file instead of its packed copy when the two
+// differ, so assets can still be modded; otherwise the pack is used as-is and the loose files are never looked at.
+const string assetPackFilename = "Assets.pack";
+const char* const assetFolders[] = { "Tiles", "Sprites", "Text", "Fullscreen Assets" };
+const char packMagic[4] = { 'B', 'R', 'A', 'P' };
+const uint16_t packVersion = 2;
+enum packKinds { packFile, packImage };
+struct PackHeader {
+    char magic[4];
+    uint16_t version, reserved;
+    uint32_t entryCount, entryBytes; // entryBytes is sizeof(PackEntry), checked on load
+    uint64_t indexOffset;
+};
+static_assert(sizeof(PackHeader) == 24, "pack header must stay 24 bytes");
+struct PackEntry {
+    char path[88]; // relative, '/' separated, zero padded
+    uint32_t kind, width, height; // width & height for packImage
+    uint32_t sourceHash; // FNV-1a of the file it was baked from
+    uint64_t sourceBytes;
+    uint64_t offset, bytes;
+};
+static_assert(sizeof(PackEntry) == 128, "pack entries must stay 128 bytes");
+
+uint32_t hashBytes(const char* data, size_t bytes) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < bytes; i++) hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    return hash;
+}
+bool readFileBytes(const string& filename, vector<char>& contents) {
+    ifstream in(filename, ios::binary);
+    if (!in.is_open()) return false;
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+class AssetPack {
+private:
+    MappedFile mapped;
+    unordered_map<string, PackEntry> index;
+
+    static bool looseDiffers(const PackEntry& entry) {
+        // Same size and contents as when it was baked, or missing: the packed copy stands
+        error_code err;
+        uintmax_t bytes = fs::file_size(entry.path, err);
+        if (err) return false;
+        if (bytes != entry.sourceBytes) return true;
+
+        vector<char> contents;
+        return readFileBytes(entry.path, contents) && hashBytes(contents.data(), contents.size()) != entry.sourceHash;
+    }
+
+public:
+    bool open(string filename, bool looseOverrides) {
+        mapped.close();
+        index.clear();
+        if (!mapped.open(filename)) return false;
+
+        PackHeader head;
+        if (mapped.size() < sizeof(head)) {
+            mapped.close();
+            return false;
+        }
+        memcpy(&head, mapped.data(), sizeof(head));
+        if (memcmp(head.magic, packMagic, 4) != 0 || head.version != packVersion || head.entryBytes != sizeof(PackEntry)
+            || head.indexOffset + (uint64_t)head.entryCount * sizeof(PackEntry) > mapped.size()) {
+            cout << "\nWarning: " << filename << " is not a version " << packVersion << " asset pack, using loose files.";
+            mapped.close();
+            return false;
+        }
+
+        // Loose files are only compared here, once, and only when overrides are enabled
+        for (uint32_t i = 0; i < head.entryCount; i++) {
+            PackEntry entry;
+            memcpy(&entry, mapped.data() + head.indexOffset + i * sizeof(entry), sizeof(entry));
+            entry.path[sizeof(entry.path) - 1] = 0;
+            if (entry.offset + entry.bytes > head.indexOffset) continue;
+
+            if (looseOverrides && looseDiffers(entry)) continue;
+            index[entry.path] = entry;
+        }
+        return true;
+    }
+
+    bool image(const string& filename, sf::Image& out) const {
+        auto it = index.find(filename);
+        if (it == index.end() || it->second.kind != packImage || it->second.bytes != (uint64_t)it->second.width * it->second.height * 4) return false;
+        out.create(it->second.width, it->second.height, mapped.data() + it->second.offset);
+        return true;
+    }
+    bool file(const string& filename, const char*& data, size_t& bytes) const {
+        auto it = index.find(filename);
+        if (it == index.end() || it->second.kind != packFile) return false;
+        data = (const char*)mapped.data() + it->second.offset;
+        bytes = (size_t)it->second.bytes;
+        return true;
+    }
+    size_t count() const {
+        return index.size();
+    }
+};
+AssetPack assetPack;
 
 // Startup settings & defaults
 const string title = "The Backrooms: 1991";
@@ -46,48 +617,513 @@ int ctrlMap[] = {-1, -1, 1, -1, 7, 6, 0, 1, 2, 3, 4, 5}; // jst y inv, jst x inv
 
 int scale = 200, aspectRatio = 0, maxFrameRate = 0, frameRateIndex = 0, fov = 0, vignetteStep = 2, vignetteIntens = 5;
 bool showScanlines, blur;
+bool softwareRender = false; // rasterize the 256x224 buffer on the CPU instead of through OpenGL (--software)
+#ifdef _DEBUG
+bool looseAssets = true; // loose asset files that differ from their packed copy replace it (--loose-assets in release builds)
+#else
+bool looseAssets = false;
+#endif
 const int stdFrameRate[] = { 0, 30, 60, 75, 120, 144, 240, 360, 0}; // 0 = V-Sync
 
 // State data
 int screen, textPhase = 1, inputTimer, selection = 0, mappedButtons = 0, frameCount = 0, frUpdateCount = 0, retScreen;
 float frameTime, avgFrameTime, currentFrameRate, frUpdate;
 float frameScl; // Normalize for 60 fps
+
+// Fixed-rate simulation (rendering interpolates between the last two steps)
+const float simStep = 1000.f / 120; // ms per simulation step
+const float simScl = simStep / 16.6667; // movement per step, normalized for 60 fps like frameScl
+const float maxSimLag = 250; // ms of simulation to catch up on before dropping time
+const float contactDamageInterval = 1000.f / 60; // ms between hits from one enemy (once a frame at the original 60 fps)
+float simAccumulator = 0, simAlpha = 0;
+sf::Vector2f prevPPos, prevScreenPos;
+int lastGameFrame = -2; // frame mainGame last ran, to detect resuming from another screen
 bool pressed[12]; // up, dn, lt, rt, start, select, a, b, x, y, lb, rb
 
 // Global SFML & graphics objects
 sf::Clock clk;
-sf::RenderTexture buffer;
-sf::RenderWindow window(sf::VideoMode(512, 448), title);
+sf::Clock startupClock; // since launch, for the time to first frame
+// Created in main after the command line is read, since the first OpenGL object starts SFML's GL context and --bake-assets runs without one
+unique_ptr<sf::RenderTexture> buffer;
+unique_ptr<sf::RenderWindow> window;
 sf::Sprite bufferObj;
 sf::Sprite scanlineObj;
 
 int tilemap[4][64][64];
+sf::Vector2i tilemapSize[4]; // tiles wide / high of the map currently loaded into each layer
+
+// Cached tile meshes (one quad per tile, row-major so visible rows are contiguous)
+sf::VertexArray tileMesh[4];
+size_t tileMeshRows[4][65]; // index of first vertex in each row
+
+// Cached text: each string is laid out as a run of glyph quads once and reused while it stays on screen
+struct GlyphRun {
+    int x, y;
+    sf::Color color;
+    sf::VertexArray vertices;
+    int lastUsed; // frame number
+};
+unordered_map<string, vector<GlyphRun>> textCache;
+const int textCacheLife = 300; // frames an unused run is kept
+
+// Render queue: draws are tagged with a layer and depth, sorted, and merged into batches of consecutive draws sharing a texture at the end of the frame
+enum drawLayers { bgLayer, entityLayer, fgLayer, effectLayer, uiLayer, overlayLayer };
+struct RenderCommand {
+    int layer, depth, order;
+    const sf::Texture* texture = nullptr; // nullptr for solid colour
+    size_t first, count; // quad vertices in the frame's vertex list
+};
+
+// Frame snapshot: everything needed to draw and present one frame, so it can be handed to the render thread
+struct FrameSnapshot {
+    vector<RenderCommand> commands;
+    vector<sf::Vertex> vertices;
+    bool clear = false;
+    sf::Color clearColor;
+
+    // Presentation settings
+    int frameRateLimit = 0;
+    bool smooth = false, scanlines = false;
+    sf::Vector2u windowSize;
+};
+FrameSnapshot currentFrame; // being recorded by the game thread
+int drawLayer = bgLayer, drawDepth = 0; // tags applied to queued draws
+atomic<int> drawCalls(0); // submitted by the last frame drawn, shown in the debug overlay
+
+// Render thread: draws and presents snapshots while the game thread simulates the next frame
+bool useRenderThread = true; // --no-render-thread to draw on the main thread
+bool renderThreadRunning = false, framePending = false;
+FrameSnapshot pendingFrame; // handed from game thread to render thread
+thread renderThread;
+mutex frameLock;
+condition_variable frameSignal;
+mutex gpuLock; // held while GL resources shared between the threads are drawn or changed
+
+// Chunk neighbourhood: the 3x3 chunks around the player, kept loaded and pre-rendered so scrolling can cross chunk edges,
+// plus the chunks beyond the edges the player is heading for, streamed in before they're needed
+enum viewStates { viewEmpty, viewQueued, viewDecoded, viewReady }; // queued for the stream thread, decoded but not rendered yet
+struct ChunkView {
+    ChunkCoord chunk;
+    int state = viewEmpty; // guarded by streamLock
+    int lastWanted = 0; // streamChunks call that last asked for it, oldest views are reused first
+    bool loaded = false; // false for chunks beyond the map's edge
+    TileId walls[64 * 64]; // row-major
+    TileId cosmetic[64 * 64]; // wall tops, derived from walls
+    int target = -1; // chunkTargets index while it's on or near the screen (game thread only)
+};
+const int chunkPoolSize = 16; // 3x3, plus the column, row and corner past the edges being approached
+ChunkView chunkPool[chunkPoolSize];
+int chunkSlot[3][3]; // pool index of chunk (chunk.x + x - 1, chunk.y + y - 1)
+
+// Pre-rendered chunk layers, 8 MB of video memory each, so only the views on or within chunkTargetMargin of the screen
+// have one. That area is smaller than a chunk, so it never touches more than 2x2 chunks and four targets are recycled between views.
+const int chunkTargetCount = 4;
+const float chunkTargetMargin = 256.f; // px, a view is pre-rendered once it's this close to the screen
+struct ChunkTarget {
+    unique_ptr<sf::RenderTexture> layers[2]; // walls (0) and cosmetic wall tops (1), created on first use
+};
+ChunkTarget chunkTargets[chunkTargetCount];
+
+// Decoded chunk cache: the tiles and cosmetic layer of recently visited chunks, so walking back and forth never
+// touches the disk. Least recently used chunks are dropped once the budget is reached.
+struct CachedChunk {
+    ChunkCoord chunk;
+    TileId walls[64 * 64];
+    TileId cosmetic[64 * 64];
+};
+class ChunkCache {
+private:
+    list<CachedChunk> entries; // most recently used first
+    unordered_map<ChunkCoord, list<CachedChunk>::iterator, ChunkCoordHash> index;
+    size_t budget = 0;
+    int hits = 0, misses = 0;
+    mutable mutex lock; // used from the stream thread and the main thread
+
+    size_t capacity() const {
+        return max((size_t)1, budget / sizeof(CachedChunk));
+    }
+
+public:
+    void setBudget(size_t bytes) {
+        lock_guard<mutex> guard(lock);
+        budget = bytes;
+        while (entries.size() > capacity()) {
+            index.erase(entries.back().chunk);
+            entries.pop_back();
+        }
+    }
+
+    bool get(ChunkCoord chunk, TileId* walls, TileId* cosmetic) {
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(chunk);
+        if (it == index.end()) {
+            misses++;
+            return false;
+        }
+
+        hits++;
+        entries.splice(entries.begin(), entries, it->second);
+        memcpy(walls, it->second->walls, sizeof(CachedChunk::walls));
+        memcpy(cosmetic, it->second->cosmetic, sizeof(CachedChunk::cosmetic));
+        return true;
+    }
+    void put(ChunkCoord chunk, const TileId* walls, const TileId* cosmetic) {
+        lock_guard<mutex> guard(lock);
+        auto it = index.find(chunk);
+        if (it != index.end()) entries.splice(entries.begin(), entries, it->second);
+        else if (entries.size() >= capacity()) {
+            // Reuse the least recently used entry rather than allocating
+            index.erase(entries.back().chunk);
+            entries.splice(entries.begin(), entries, prev(entries.end()));
+        }
+        else entries.emplace_front();
+
+        CachedChunk& entry = entries.front();
+        entry.chunk = chunk;
+        memcpy(entry.walls, walls, sizeof(entry.walls));
+        memcpy(entry.cosmetic, cosmetic, sizeof(entry.cosmetic));
+        index[chunk] = entries.begin();
+    }
+    void clear() {
+        lock_guard<mutex> guard(lock);
+        entries.clear();
+        index.clear();
+        hits = misses = 0;
+    }
+
+    void stats(int& hitCount, int& missCount, size_t& bytes) const {
+        lock_guard<mutex> guard(lock);
+        hitCount = hits;
+        missCount = misses;
+        bytes = entries.size() * sizeof(CachedChunk);
+    }
+};
+ChunkCache chunkCache;
+
+// Chunk streaming: a worker thread reads (or in endless maps, generates) chunk views and saves visited endless chunks,
+// so crossing a chunk edge only swaps views
+struct StreamJob {
+    int view = -1; // pool index to load, or -1 to save
+    ChunkCoord chunk;
+    vector<TileId> walls; // tiles to save
+};
+const float prefetchDistance = 256.f; // stream the next chunks in when heading for an edge this close
+const float prefetchAlways = 96.f; // or standing this close to one
+thread streamThread;
+bool streamRunning = false, streamBusy = false;
+deque<StreamJob> streamJobs;
+int streamStamp = 0;
+mutex streamLock;
+condition_variable streamWake, streamDone;
+
+// Texture registry: owns every loaded texture and hands out handles, so draw calls never copy one.
+// PNGs decode on worker threads in load order, so assets loaded first are ready first; each texture is uploaded
+// on the main thread the first time it is used, or sooner by uploadDecoded() as the decoders finish
+struct TextureHandle {
+    int id = -1;
+};
+class TextureRegistry {
+private:
+    struct Asset {
+        string name;
+        string filename;
+        sf::Image image; // CPU copy for the software renderer
+        sf::Texture texture;
+        bool decoded = false, failed = false; // written under decodeLock
+        bool uploaded = false; // main thread only
+    };
+    deque<Asset> assets; // deque keeps textures in place as more are added (sprites hold pointers to them)
+    deque<Asset*> decodeQueue;
+    vector<thread> decoders;
+    int activeDecoders = 0;
+    mutex decodeLock;
+    condition_variable decodeDone;
+
+    void decodeAssets() {
+        unique_lock<mutex> guard(decodeLock);
+        while (!decodeQueue.empty()) {
+            Asset* asset = decodeQueue.front();
+            decodeQueue.pop_front();
+
+            guard.unlock();
+            bool ok = asset->image.loadFromFile(asset->filename);
+            guard.lock();
+
+            asset->failed = !ok;
+            asset->decoded = true;
+            decodeDone.notify_all();
+        }
+        activeDecoders--;
+    }
+    void upload(Asset& asset) {
+        {
+            unique_lock<mutex> guard(decodeLock);
+            decodeDone.wait(guard, [&] { return asset.decoded; });
+        }
+
+        if (asset.failed) cout << "\nUnable to load " << asset.name << ".";
+        else {
+            lock_guard<mutex> gpu(gpuLock);
+            asset.texture.loadFromImage(asset.image);
+        }
+        asset.uploaded = true;
+    }
+
+public:
+    TextureHandle load(string name, string filename) {
+        TextureHandle handle;
+        handle.id = (int)assets.size();
+
+        assets.emplace_back();
+        Asset& asset = assets.back();
+        asset.name = name;
+        asset.filename = filename;
+        if (assetPack.image(filename, asset.image)) { // baked pixels need no decoding
+            asset.decoded = true;
+            return handle;
+        }
+
+        lock_guard<mutex> guard(decodeLock);
+        decodeQueue.push_back(&asset);
+        if (activeDecoders < max(1, (int)thread::hardware_concurrency())) {
+            activeDecoders++;
+            decoders.emplace_back(&TextureRegistry::decodeAssets, this);
+        }
+
+        return handle;
+    }
+    TextureHandle add(string name) { // for textures generated at run time
+        TextureHandle handle;
+        handle.id = (int)assets.size();
+
+        assets.emplace_back();
+        assets.back().name = name;
+        assets.back().filename = "(generated)";
+        assets.back().decoded = assets.back().uploaded = true;
+
+        return handle;
+    }
+
+    void update(TextureHandle handle, const sf::Image& image) {
+        assets[handle.id].image = image;
+        assets[handle.id].texture.loadFromImage(image);
+    }
+
+    sf::Texture& get(TextureHandle handle) { // waits for the texture if it is still decoding
+        Asset& asset = assets[handle.id];
+        if (!asset.uploaded) upload(asset);
+        return asset.texture;
+    }
+    void uploadDecoded() { // once a frame: upload one finished texture, so the rest trickle in without a long frame
+        for (Asset& asset : assets) {
+            if (asset.uploaded) continue;
+
+            bool decoded;
+            {
+                lock_guard<mutex> guard(decodeLock);
+                decoded = asset.decoded;
+            }
+            if (decoded) {
+                upload(asset);
+                return;
+            }
+        }
+    }
+    void finish() {
+        for (thread& decoder : decoders) decoder.join();
+        decoders.clear();
+    }
+    const sf::Image& image(TextureHandle handle) const {
+        return assets[handle.id].image;
+    }
+    TextureHandle find(const sf::Texture* texture) const {
+        TextureHandle handle;
+        for (int i = 0; i < (int)assets.size(); i++) {
+            if (&assets[i].texture == texture) handle.id = i;
+        }
+        return handle;
+    }
+
+    size_t bytes(TextureHandle handle) const {
+        sf::Vector2u size = assets[handle.id].texture.getSize();
+        return (size_t)size.x * size.y * 4; // RGBA8
+    }
+    size_t totalBytes() const {
+        size_t total = 0;
+        for (int i = 0; i < (int)assets.size(); i++) total += bytes(TextureHandle{ i });
+        return total;
+    }
+
+    void report() const {
+        cout << "\n   Textures:";
+        for (int i = 0; i < (int)assets.size(); i++) {
+            sf::Vector2u size = assets[i].texture.getSize();
+            cout << "\n     " << assets[i].name << " (" << assets[i].filename << "): ";
+            if (!assets[i].uploaded) cout << "loading";
+            else cout << size.x << "x" << size.y << ", " << bytes(TextureHandle{ i }) << " bytes";
+        }
+        cout << "\n   Total: " << totalBytes() << " bytes";
+    }
+};
+TextureRegistry textures;
+
+// String table: Text/*.txt files split into lines on first use and kept, so menus don't reopen them every frame.
+// With loose assets enabled (debug builds or --loose-assets), each file's time stamp is checked every textCheckInterval and the loose file
+// re-read when it changes, so text can still be edited live.
+const sf::Int32 textCheckInterval = 500; // ms
+class StringTable {
+private:
+    struct TextFile {
+        vector<string> lines;
+        fs::file_time_type looseTime; // of the loose file when read
+        sf::Int32 checkedAt = 0;
+    };
+    unordered_map<string, TextFile> files;
+    sf::Clock clock;
+    const string empty;
+
+    static void split(const char* text, size_t bytes, vector<string>& lines) { // same lines getline() would give
+        lines.clear();
+        const char* end = text + bytes;
+        while (text < end) {
+            const char* lineEnd = find(text, end, '\n');
+            const char* trimmed = lineEnd > text && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+            lines.emplace_back(text, trimmed);
+            text = lineEnd == end ? end : lineEnd + 1;
+        }
+    }
+    static bool readLoose(const string& filename, vector<string>& lines) {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) return false;
+        string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        split(text.data(), text.size(), lines);
+        return true;
+    }
+
+public:
+    const vector<string>& lines(const string& filename) {
+        sf::Int32 now = clock.getElapsedTime().asMilliseconds();
+        error_code err;
+        auto it = files.find(filename);
+
+        if (it == files.end()) {
+            TextFile& file = files[filename];
+            const char* packed;
+            size_t bytes;
+            if (assetPack.file(filename, packed, bytes)) split(packed, bytes, file.lines);
+            else if (!readLoose(filename, file.lines)) cout << "\nUnable to open text: " << filename;
+            if (looseAssets) file.looseTime = fs::last_write_time(filename, err);
+            file.checkedAt = now;
+            return file.lines;
+        }
+
+        TextFile& file = it->second;
+        if (looseAssets && now - file.checkedAt >= textCheckInterval) {
+            file.checkedAt = now;
+            fs::file_time_type time = fs::last_write_time(filename, err);
+            if (!err && time != file.looseTime && readLoose(filename, file.lines)) {
+                file.looseTime = time;
+                if (showDebugInfo) cout << "\nReloaded " << filename;
+            }
+        }
+        return file.lines;
+    }
+    const string& line(const string& filename, int n) { // empty past the end of the file
+        const vector<string>& text = lines(filename);
+        return n >= 0 && n < (int)text.size() ? text[n] : empty;
+    }
+};
+StringTable strings;
+
+// Profiler: scoped timers per section, kept over a rolling window of frames for the debug overlay
+const int profWindow = 120; // frames
+enum profSections { profInput, profSim, profPlayer, profEnemies, profChunks, profTiles, profEntities, profVignette, profUI, profPresent, numProfSections };
+struct ProfileSection {
+    string name;
+    int parent; // -1 for top level
+    sf::Int64 frameTime = 0; // microseconds spent this frame
+    bool hit = false; // entered this frame
+    float samples[profWindow]; // ms per frame
+    int next = 0, count = 0;
+    float minMs = 0, avgMs = 0, p99Ms = 0;
+};
+ProfileSection profile[numProfSections] = {
+    {"Input", -1}, {"Sim", -1}, {"Player", profSim}, {"Enemies", profSim}, {"Chunks", profSim},
+    {"Tiles", -1}, {"Entities", -1}, {"Vignette", -1}, {"UI", -1}, {"Present", -1}
+};
+float frameGraph[profWindow]; // frame times in ms, for the overlay graph
+int frameGraphNext = 0;
+sf::Clock profClock;
+struct ProfileScope {
+    int section;
+    sf::Int64 start;
+
+    ProfileScope(int section) : section(section), start(profClock.getElapsedTime().asMicroseconds()) {}
+    ~ProfileScope() {
+        profile[section].frameTime += profClock.getElapsedTime().asMicroseconds() - start;
+        profile[section].hit = true;
+    }
+};
 
 // Graphics assets
-sf::Texture scanlines;
-sf::Texture font;
-sf::Texture titleScreen;
-sf::Texture menu;
-sf::Texture controls;
-sf::Texture settings;
-
-sf::Texture walls;
-sf::Texture player;
-sf::Texture enemy;
-sf::Texture ui;
+TextureHandle scanlines;
+TextureHandle font;
+TextureHandle titleScreen;
+TextureHandle menu;
+TextureHandle controls;
+TextureHandle settings;
+
+TextureHandle walls;
+TextureHandle player;
+TextureHandle enemy;
+TextureHandle ui;
+TextureHandle vignetteMask;
+TextureHandle softwareFrameTex;
+
+// Software renderer frame (RGBA, same layout as sf::Image pixels)
+vector<sf::Color> softwareFrame(256 * 224);
 
 sf::Sprite playerObj;
 sf::Sprite enemyObj;
+sf::Sprite vignetteObj;
 
 // Engine functions
-void drawTilemapStatic(sf::Texture tex, int layer);
-void drawTilemapStatic(sf::Texture tex);
-void drawTilemapScroll(sf::Texture tex, int layer);
-void drawTilemapScroll(sf::Texture tex);
-void drawText(int x, int y, string text, sf::Color color);
-void drawText(int x, int y, string text);
+void drawTilemapStatic(TextureHandle tex, int layer);
+void drawTilemapStatic(TextureHandle tex);
+void drawText(int x, int y, const string& text, sf::Color color);
+void drawText(int x, int y, const string& text);
+void trimTextCache();
+
+// Software renderer
+void clearBuffer(sf::Color color);
+void clearBuffer();
+void drawSprite(const sf::Sprite& spr);
+void drawShape(const sf::RectangleShape& rect);
+void softwareBlit(const sf::Image& src, sf::IntRect rect, int x, int y, sf::Color color);
+void softwareFill(sf::IntRect rect, sf::Color color);
+sf::Uint32 softwareFrameHash();
+
+// Render queue
+void setDrawOrder(int layer, int depth);
+void queueVertices(const sf::Texture* tex, const sf::Vertex* vertices, size_t count, sf::Vector2f offset);
+void queueQuad(const sf::Texture* tex, sf::FloatRect dst, sf::IntRect src, sf::Color color);
+void drawFrame(FrameSnapshot& frame);
+void resetFrame(FrameSnapshot& frame);
+
+// Render thread
+void presentFrame();
+void renderLoop();
+void startRenderThread();
+void stopRenderThread();
+void closeWindow();
+bool bakeAssets();
+bool readTilemap(string filename, int tiles[64][64], sf::Vector2i& size);
+bool readTilemap(string filename, int layer, int tiles[64][64], sf::Vector2i& size);
 void loadTilemap(string filename, int layer);
 void loadTilemap(string filename);
+void appendTileQuad(sf::VertexArray& mesh, int tileID, float px, float py);
+void buildTileMesh(int layer);
+void drawTileMesh(TextureHandle tex, int layer, int firstRow, int lastRow, sf::Vector2i offset);
 
 void readInput();
 void MapControls();
@@ -95,6 +1131,7 @@ void saveControlMap();
 void loadControlMap();
 void saveGfxSettings();
 void loadGfxSettings();
+sf::Vector2u gfxWindowSize();
 
 void movePlayer(float speed, int layer); // layer determines collision detection
 void movePlayer(float speed);
@@ -106,12 +1143,56 @@ void drawStatusBars();
 void updateFrameTime();
 void updateScreen();
 void update();
+void endProfileFrame();
+void updateProfileStats();
+void drawProfiler();
 
 // Game Functions
 void drawHighlightBox(int x, int y, int width);
-void generateMap();
+bool generateMap();
+void beginGenPhase(int phase);
+void resetMapFolder();
+void startMapGen();
+void cancelMapGen();
+void generateChunk(TileId* walls, ChunkCoord chunk);
+void buildChunkWalls(TileId* walls, ChunkCoord chunk);
+void cutChunkDoors(TileId* walls, ChunkCoord chunk);
+void autotileChunk(TileId* walls);
+void autotileRect(TileId* walls, sf::IntRect rect);
+uint64_t solidRow(const TileId* row);
+void saveChunk(TileId* walls, ChunkCoord chunk);
+bool readChunk(ChunkCoord chunk, TileId* walls);
+void writeCodecOp(vector<uint8_t>& out, int op, int length);
+void compressTiles(const TileId* walls, vector<uint8_t>& out);
+bool decompressTiles(const uint8_t* in, size_t bytes, TileId* walls);
+bool readChunkBinary(string filename, TileId* walls);
+void exportChunkText(string filename, TileId* walls);
+bool importChunkText(string filename, TileId* walls);
+string chunkTextFilename(ChunkCoord chunk);
+bool chunkSaved(ChunkCoord chunk);
+bool chunkInMap(ChunkCoord chunk);
+ArchiveHeader worldHeader();
+bool loadWorldInfo();
+bool parseChunkFilename(const fs::path& path, ChunkCoord& chunk);
+void importLooseChunks(bool legacyMap);
+void importLegacyMap();
+void forEachChunk(const function<void(int, int)>& work, bool cancellable);
 void loadMap();
-void loadMapChunk(sf::Vector2i chunk);
+void loadMapChunk(ChunkCoord chunk);
+void loadChunkView(ChunkView& view, ChunkCoord chunk);
+void renderChunkView(ChunkView& view);
+void updateChunkTargets(sf::Vector2f camera);
+void clearChunkViews();
+void startStreaming();
+void stopStreaming();
+void streamLoop();
+void streamChunks(const vector<ChunkCoord>& wanted);
+void updateChunkStreaming();
+void finishChunkView(int i);
+void queueChunkSave(const TileId* walls, ChunkCoord chunk);
+void drawChunkLayer(TextureHandle tex, int layer, sf::Vector2f camera);
+int cosmeticTile(int wallTile);
+int tileAt(int layer, float x, float y);
 
 // Game Screens
 void TitleScreen();
@@ -119,9 +1200,12 @@ void MainMenu();
 void Controls();
 void GfxSettings();
 void gameSettings();
+void mapGenScreen();
 void introText();
 void pauseMenu();
 void mainGame();
+void stepGame();
+sf::Vector2f interpolate(sf::Vector2f from, sf::Vector2f to, float t);
 
 // Game Over Screens
 void victory();
@@ -129,12 +1213,15 @@ void death();
 
 // Screen Effects
 void vignette();
+void buildVignette();
 
 // Enemies
 class Enemy {
 private:
     sf::Vector2f ePos;
-    sf::Vector2i eChunk;
+    sf::Vector2f prevPos; // at the previous simulation step
+    ChunkCoord eChunk;
+    float damageCooldown = 0; // ms until this enemy can hurt the player again
 
     int id;
 
@@ -146,25 +1233,30 @@ public:
         ePos = sf::Vector2f(x, y);
     }
 
-    void setChunk(sf::Vector2i newChunk) {
+    void setChunk(ChunkCoord newChunk) {
         eChunk = newChunk;
     }
-    void setChunk(int x, int y) {
-        setChunk(sf::Vector2i(x, y));
+    void setChunk(int64_t x, int64_t y) {
+        setChunk(ChunkCoord(x, y));
     }
     void setId(int newId) {
         id = newId;
     }
+    void storePosition() {
+        prevPos = ePos;
+    }
 
-    void draw() {
-        // Don't bother for enemies in different chunk
-        if (eChunk != chunk) return;
+    void draw(sf::Vector2f camera) {
+        // Don't bother for enemies outside the loaded neighbourhood
+        ChunkCoord d = eChunk - chunk;
+        if (abs(d.x) > 1 || abs(d.y) > 1) return;
 
         // Calculate position
-        enemyObj.setPosition(ePos + chunkOffset - screenPos[0] - sf::Vector2f(8.f, 0.f));
+        enemyObj.setPosition(interpolate(prevPos, ePos, simAlpha) + sf::Vector2f(1024.f * d.x, 1024.f * d.y) + chunkOffset - camera - sf::Vector2f(8.f, 0.f));
 
-        // Draw enemy
-        buffer.draw(enemyObj);
+        // Draw enemy, sorted by feet position
+        setDrawOrder(entityLayer, (int)ePos.y + 1024 * (int)d.y);
+        drawSprite(enemyObj);
     }
 
     void save() {
@@ -189,6 +1281,7 @@ public:
 
         string expectedLabels[] = { "chunk_x:", "chunk_y:", "pos_x:", "pos_y:" };
         float values[4];
+        int64_t chunkValues[2];
 
         id = newId;
 
@@ -197,11 +1290,12 @@ public:
                 getline(file, line, ' ');
                 if (line != expectedLabels[i]) cout << "\nWarining: enemy data may not be formatted correctly (enemy " << id << ", line " << i + 1 << ").";
                 getline(file, line);
-                values[i] = stof(line);
+                if (i < 2) chunkValues[i] = stoll(line);
+                else values[i] = stof(line);
             }
 
-            eChunk.x = values[0];
-            eChunk.y = values[1];
+            eChunk.x = chunkValues[0];
+            eChunk.y = chunkValues[1];
             ePos.x = values[2];
             ePos.y = values[3];
         }
@@ -211,13 +1305,19 @@ public:
     void chasePlayer() {
         // Pursue in current chunk
         if (eChunk == chunk) {
-            if (pPos.x > ePos.x) ePos.x += 0.25 * frameScl;
-            if (pPos.x < ePos.x) ePos.x -= 0.25 * frameScl;
-            if (pPos.y > ePos.y) ePos.y += 0.25 * frameScl;
-            if (pPos.y < ePos.y) ePos.y -= 0.25 * frameScl;
+            if (pPos.x > ePos.x) ePos.x += 0.25 * simScl;
+            if (pPos.x < ePos.x) ePos.x -= 0.25 * simScl;
+            if (pPos.y > ePos.y) ePos.y += 0.25 * simScl;
+            if (pPos.y < ePos.y) ePos.y -= 0.25 * simScl;
         }
     }
     void damagePlayer() {
+        // Contact damage runs on a timer, so the damage rate doesn't depend on the simulation rate
+        if (damageCooldown > 0) {
+            damageCooldown = max(0.f, damageCooldown - simStep);
+            if (damageCooldown > 0) return;
+        }
+
         // Don't bother for enemies in different chunk
         if (eChunk != chunk) return;
 
@@ -229,6 +1329,7 @@ public:
         // Apply damage, knockback
         if (dist < 16) {
             health--;
+            damageCooldown = contactDamageInterval;
 
             // Knockback
             if (pPos.y > ePos.y + 6) pPos.y += 4;
@@ -244,15 +1345,34 @@ int numEnemies = 50;
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Command line options
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--software") softwareRender = true;
+        if (string(argv[i]) == "--no-render-thread") useRenderThread = false;
+        if (string(argv[i]) == "--loose-assets") looseAssets = true;
+        if (string(argv[i]) == "--seed" && i + 1 < argc) {
+            worldSeed = strtoull(argv[++i], nullptr, 10);
+            fixedSeed = true;
+        }
+        if (string(argv[i]) == "--gen-threads" && i + 1 < argc) genThreads = atoi(argv[++i]);
+        if (string(argv[i]) == "--text-chunks") exportTextChunks = true;
+        if (string(argv[i]) == "--raw-chunks") chunkCodec = codecRaw;
+        if (string(argv[i]) == "--chunk-cache" && i + 1 < argc) chunkCacheBudget = (size_t)max(0, atoi(argv[++i])) << 20;
+        if (string(argv[i]) == "--bake-assets") return bakeAssets() ? 0 : 1; // no window, so it runs in headless builds
+    }
+
     // Print startup info to terminal
     cout << "Opening " << title << ". Press TAB to show debug information and frame rate.\n";
+    if (softwareRender) cout << "Using software renderer.\n";
 
     // Create window
-    if(showDebugInfo) cout << "Creating window...";
+    if(showDebugInfo) cout << "Creating window->..";
 
-    window.setFramerateLimit(maxFrameRate);
-    buffer.create(256, 224);
+    window = make_unique<sf::RenderWindow>(sf::VideoMode(512, 448), title);
+    window->setFramerateLimit(maxFrameRate);
+    buffer = make_unique<sf::RenderTexture>();
+    buffer->create(256, 224);
     bufferObj.setScale(2.f, 2.f);
     //window.setMouseCursorVisible(false);
 
@@ -261,23 +1381,28 @@ int main() {
     // Load graphics
     {
         if (showDebugInfo) cout << "\nLoading graphics...";
+        if (assetPack.open(assetPackFilename, looseAssets) && showDebugInfo) cout << "\n   " << assetPack.count() << " assets from " << assetPackFilename;
+
+        // Queued in the order they are needed: the title screen first, gameplay textures behind the menus
+        scanlines = textures.load("scanline overlay", "Fullscreen Assets/Scanlines.png");
+        font = textures.load("font tileset", "Tiles/Font.png");
+        titleScreen = textures.load("title screen tileset", "Tiles/Title Screen.png");
+        menu = textures.load("menu tileset", "Tiles/Menu.png");
+        controls = textures.load("controls tileset", "Tiles/Controls.png");
+        settings = textures.load("settings tileset", "Tiles/Settings.png");
+
+        walls = textures.load("background tileset", "Tiles/Background.png");
+        ui = textures.load("user interface graphics", "Tiles/Status UI.png");
+        player = textures.load("player character", "Sprites/Generic Guy.png");
+        enemy = textures.load("enemy", "Sprites/Enemy 1.png");
+        vignetteMask = textures.add("vignette");
+        if (softwareRender) {
+            softwareFrameTex = textures.add("software frame");
+            textures.get(softwareFrameTex).create(256, 224);
+        }
 
-        if (!scanlines.loadFromFile("Fullscreen Assets/Scanlines.png")) cout << "\nUnable to load scanline overlay";
-        scanlineObj.setTexture(scanlines);
-        scanlines.setSmooth(true);
-
-        if (!font.loadFromFile("Tiles/Font.png")) cout << "\nUnable to load font tileset.";
-        if (!titleScreen.loadFromFile("Tiles/Title Screen.png")) cout << "\nUnable to load title screen tileset.";
-        if (!menu.loadFromFile("Tiles/Menu.png")) cout << "\nUnable to load font tileset.";
-        if (!controls.loadFromFile("Tiles/Controls.png")) cout << "\nUnable to load controls tileset.";
-        if (!settings.loadFromFile("Tiles/Settings.png")) cout << "\nUnable to load settings tileset.";
-
-        if (!walls.loadFromFile("Tiles/Background.png")) cout << "\nUnable to load background tileset.";
-        if (!ui.loadFromFile("Tiles/Status UI.png")) cout << "\nUnable to load user interface graphics";
-        if (!player.loadFromFile("Sprites/Generic Guy.png")) cout << "\nUnable to load player character.";
-        playerObj.setTexture(player);
-        if (!enemy.loadFromFile("Sprites/Enemy 1.png")) cout << "\nUnable to load player character.";
-        enemyObj.setTexture(enemy);
+        scanlineObj.setTexture(textures.get(scanlines));
+        textures.get(scanlines).setSmooth(true);
 
         loadTilemap("Tiles/Title Screen.txt");
         loadTilemap("Tiles/Main Menu.txt", 1);
@@ -290,22 +1415,28 @@ int main() {
     loadControlMap();
     loadGfxSettings();
 
-    // Setup RNG
-    srand((int)time(NULL));
+    // Hand drawing over to a second core
+    if (useRenderThread && thread::hardware_concurrency() > 1) startRenderThread();
+    chunkCache.setBudget(chunkCacheBudget);
+    startStreaming();
 
-    while(window.isOpen()) {
+    while(window->isOpen()) {
         // System window management
         sf::Event event;
-        if(sf::Keyboard::isKeyPressed(sf::Keyboard::End)) window.close(); // Quick exit
-        while(window.pollEvent(event)) {
-            if(event.type == sf::Event::Closed) window.close();
+        if(sf::Keyboard::isKeyPressed(sf::Keyboard::End)) closeWindow(); // Quick exit
+        while(window->pollEvent(event)) {
+            if(event.type == sf::Event::Closed) closeWindow();
         }
 
         // Toggle debug output
         if(sf::Keyboard::isKeyPressed(sf::Keyboard::Tab)) {
             if(!toggleDebugInfo) {
                 showDebugInfo = !showDebugInfo;
-                if (showDebugInfo) cout << "\n   > Showing debug info.";
+                if (showDebugInfo) {
+                    cout << "\n   > Showing debug info.";
+                    textures.report();
+                    if (softwareRender) cout << "\n   Frame hash: " << hex << softwareFrameHash() << dec;
+                }
                 else cout << "\n   > Hiding debug info.";
             }
             toggleDebugInfo = true;
@@ -320,6 +1451,7 @@ int main() {
 
             // Game setup
         case 2: gameSettings(); break;
+        case 3: mapGenScreen(); break;
         case 9: introText(); break;
 
             // Gameplay
@@ -341,7 +1473,7 @@ int main() {
 
             // Unrecognized game state
         default:
-            buffer.clear(sf::Color::Blue);
+            clearBuffer(sf::Color::Blue);
             drawText(0, 0, "Error: unrecognized game state.", sf::Color::White);
             drawText(0, 16, "Screen: " + to_string(screen), sf::Color::Cyan);
         }
@@ -349,6 +1481,10 @@ int main() {
         update();
     }
 
+    cancelMapGen();
+    stopStreaming();
+    textures.finish();
+    stopRenderThread();
     cout << "\n\n\nThank you for playing!\n\n\n";
 
     sf::sleep(sf::seconds(3));
@@ -359,115 +1495,567 @@ int main() {
 
 
 // Engine functions
-void drawTilemapStatic(sf::Texture tex, int layer) {
-    sf::Sprite tile;
-    tile.setTexture(tex);
-    int tileID, tileX, tileY;
+void drawTilemapStatic(TextureHandle tex, int layer) {
+    drawTileMesh(tex, layer, 0, 14, sf::Vector2i(0, 0));
+}
+void drawTilemapStatic(TextureHandle tex) {
+    drawTilemapStatic(tex, 0);
+}
+void appendTileQuad(sf::VertexArray& mesh, int tileID, float px, float py) {
+    float tileX = (tileID % 16) * 16.f;
+    float tileY = (tileID / 16) * 16.f;
+
+    mesh.append(sf::Vertex(sf::Vector2f(px, py), sf::Vector2f(tileX, tileY)));
+    mesh.append(sf::Vertex(sf::Vector2f(px + 16, py), sf::Vector2f(tileX + 16, tileY)));
+    mesh.append(sf::Vertex(sf::Vector2f(px + 16, py + 16), sf::Vector2f(tileX + 16, tileY + 16)));
+    mesh.append(sf::Vertex(sf::Vector2f(px, py + 16), sf::Vector2f(tileX, tileY + 16)));
+}
+void buildTileMesh(int layer) {
+    sf::VertexArray& mesh = tileMesh[layer];
+    int tileID;
+
+    mesh.clear();
+    mesh.setPrimitiveType(sf::Quads);
+
+    for (int y = 0; y < tilemapSize[layer].y; y++) {
+        tileMeshRows[layer][y] = mesh.getVertexCount();
 
-    for(int x = 0; x < 16; x++) {
-        for(int y = 0; y < 14; y++) {
+        for (int x = 0; x < tilemapSize[layer].x; x++) {
             tileID = tilemap[layer][x][y];
-            tile.setPosition(16.f * x, 16.f * y);
+            if (tileID != -1) appendTileQuad(mesh, tileID, 16.f * x, 16.f * y);
+        }
+    }
+    for (int y = tilemapSize[layer].y; y <= 64; y++) tileMeshRows[layer][y] = mesh.getVertexCount();
+}
+void drawTileMesh(TextureHandle tex, int layer, int firstRow, int lastRow, sf::Vector2i offset) {
+    if (firstRow < 0) firstRow = 0;
+    if (lastRow > tilemapSize[layer].y) lastRow = tilemapSize[layer].y;
+    if (firstRow >= lastRow) return;
+
+    size_t first = tileMeshRows[layer][firstRow];
+    size_t count = tileMeshRows[layer][lastRow] - first;
+    if (count == 0) return;
 
-            tileX =(tileID % 16); tileX *= 16;
-            tileY =(tileID / 16); tileY *= 16;
+    sf::Vector2f translation(-offset.x, -offset.y);
+    queueVertices(&textures.get(tex), &tileMesh[layer][first], count, translation); // visible rows only, batched with the rest of the frame
+}
+void drawText(int x, int y, const string& txt, sf::Color color) {
+    if (txt.empty()) return;
+
+    // Find cached layout
+    vector<GlyphRun>& runs = textCache[txt];
+    GlyphRun* run = nullptr;
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (runs[i].x == x && runs[i].y == y && runs[i].color == color) {
+            run = &runs[i];
+            break;
+        }
+    }
 
-            tile.setTextureRect(sf::IntRect(tileX, tileY, 16, 16));
+    // Lay out new string
+    if (run == nullptr) {
+        runs.emplace_back();
+        run = &runs.back();
+        run->x = x;
+        run->y = y;
+        run->color = color;
+        run->vertices.setPrimitiveType(sf::Quads);
+        run->vertices.resize(txt.length() * 4);
+
+        float cx, cy, px = (float)x, py = (float)y;
+        unsigned char c;
+
+        for (int i = 0; i < txt.length(); i++) {
+            c = txt[i] - 32;
+            cx = (c % 16) * 8.f;
+            cy = (c / 16) * 16.f;
+
+            run->vertices[i * 4 + 0] = sf::Vertex(sf::Vector2f(px, py), color, sf::Vector2f(cx, cy));
+            run->vertices[i * 4 + 1] = sf::Vertex(sf::Vector2f(px + 8, py), color, sf::Vector2f(cx + 8, cy));
+            run->vertices[i * 4 + 2] = sf::Vertex(sf::Vector2f(px + 8, py + 16), color, sf::Vector2f(cx + 8, cy + 16));
+            run->vertices[i * 4 + 3] = sf::Vertex(sf::Vector2f(px, py + 16), color, sf::Vector2f(cx, cy + 16));
+            px += 8;
+        }
+    }
 
-            if (tileID != -1) buffer.draw(tile);
+    run->lastUsed = frameCount;
+    queueVertices(&textures.get(font), &run->vertices[0], run->vertices.getVertexCount(), sf::Vector2f(0.f, 0.f));
+}
+void drawText(int x, int y, const string& txt) {
+    drawText(x, y, txt, sf::Color::Black);
+}
+void trimTextCache() {
+    // Drop layouts that haven't been drawn recently (e.g. old FPS readings)
+    for (auto it = textCache.begin(); it != textCache.end();) {
+        vector<GlyphRun>& runs = it->second;
+        for (int i = (int)runs.size() - 1; i >= 0; i--) {
+            if (frameCount - runs[i].lastUsed > textCacheLife) runs.erase(runs.begin() + i);
         }
+
+        if (runs.empty()) it = textCache.erase(it);
+        else it++;
     }
 }
-void drawTilemapStatic(sf::Texture tex) {
-    drawTilemapStatic(tex, 0);
+void clearBuffer(sf::Color color) {
+    // Anything still queued would be drawn over anyway
+    currentFrame.commands.clear();
+    currentFrame.vertices.clear();
+
+    currentFrame.clear = true;
+    currentFrame.clearColor = color;
 }
-void drawTilemapScroll(sf::Texture tex, int layer) {
-    sf::Sprite tile;
-    tile.setTexture(tex);
-    int tileID, tileX, tileY;
-    int dx = screenPos[layer].x, dy = screenPos[layer].y, dxt = dx / 16, dyt = dy / 16;
-
-    for (int x = dxt; x < 17 + dxt; x++) {
-        for (int y = dyt; y < 15 + dyt; y++) {
-            if (x >= 0 && y >= 0 && x < 64 && y < 64) {
-                tileID = tilemap[layer][x][y];
-                tileX = (tileID % 16); tileX *= 16;
-                tileY = (tileID / 16); tileY *= 16;
-
-                tile.setColor(sf::Color::White);
-                tile.setTextureRect(sf::IntRect(tileX, tileY, 16, 16));
+void clearBuffer() {
+    clearBuffer(sf::Color::Black);
+}
+void drawSprite(const sf::Sprite& spr) {
+    if (spr.getTexture() == nullptr) return;
+    queueQuad(spr.getTexture(), spr.getGlobalBounds(), spr.getTextureRect(), spr.getColor());
+}
+void drawShape(const sf::RectangleShape& rect) {
+    float x = rect.getPosition().x, y = rect.getPosition().y;
+    float w = rect.getSize().x, h = rect.getSize().y, t = rect.getOutlineThickness();
+    sf::IntRect none;
+
+    if (rect.getFillColor().a > 0) queueQuad(nullptr, sf::FloatRect(x, y, w, h), none, rect.getFillColor());
+    if (t > 0) {
+        queueQuad(nullptr, sf::FloatRect(x - t, y - t, w + 2 * t, t), none, rect.getOutlineColor()); // top
+        queueQuad(nullptr, sf::FloatRect(x - t, y + h, w + 2 * t, t), none, rect.getOutlineColor()); // bottom
+        queueQuad(nullptr, sf::FloatRect(x - t, y, t, h), none, rect.getOutlineColor()); // left
+        queueQuad(nullptr, sf::FloatRect(x + w, y, t, h), none, rect.getOutlineColor()); // right
+    }
+}
+inline void blendPixel(sf::Color& dst, sf::Color src) {
+    // Matches sf::BlendAlpha
+    if (src.a == 255) dst = src;
+    else if (src.a != 0) {
+        int a = src.a, ia = 255 - a;
+        dst.r = (src.r * a + dst.r * ia + 127) / 255;
+        dst.g = (src.g * a + dst.g * ia + 127) / 255;
+        dst.b = (src.b * a + dst.b * ia + 127) / 255;
+        dst.a = a + (dst.a * ia + 127) / 255;
+    }
+}
+void softwareBlit(const sf::Image& src, sf::IntRect rect, int x, int y, sf::Color color) {
+    sf::Vector2u size = src.getSize();
+
+    // Clip to source image
+    if (rect.left < 0) { x -= rect.left; rect.width += rect.left; rect.left = 0; }
+    if (rect.top < 0) { y -= rect.top; rect.height += rect.top; rect.top = 0; }
+    if (rect.left + rect.width > (int)size.x) rect.width = size.x - rect.left;
+    if (rect.top + rect.height > (int)size.y) rect.height = size.y - rect.top;
+
+    // Clip to buffer
+    if (x < 0) { rect.left -= x; rect.width += x; x = 0; }
+    if (y < 0) { rect.top -= y; rect.height += y; y = 0; }
+    if (x + rect.width > 256) rect.width = 256 - x;
+    if (y + rect.height > 224) rect.height = 224 - y;
+
+    if (rect.width <= 0 || rect.height <= 0) return;
+
+    const sf::Color* pixels = reinterpret_cast<const sf::Color*>(src.getPixelsPtr());
+    bool tint = color != sf::Color::White;
+
+    for (int row = 0; row < rect.height; row++) {
+        const sf::Color* s = pixels + (rect.top + row) * size.x + rect.left;
+        sf::Color* d = &softwareFrame[(y + row) * 256 + x];
+
+        if (tint) {
+            for (int i = 0; i < rect.width; i++) blendPixel(d[i], s[i] * color);
+            continue;
+        }
+
+        // Copy opaque runs in one go, blend the rest
+        int i = 0, run;
+        while (i < rect.width) {
+            if (s[i].a == 255) {
+                for (run = i; run < rect.width && s[run].a == 255; run++);
+                memcpy(d + i, s + i, (run - i) * sizeof(sf::Color));
+                i = run;
             }
             else {
-                tile.setTextureRect(sf::IntRect(0, 0, 16, 16));
-                tile.setColor(sf::Color::Black);
+                blendPixel(d[i], s[i]);
+                i++;
             }
+        }
+    }
+}
+void softwareFill(sf::IntRect rect, sf::Color color) {
+    if (rect.left < 0) { rect.width += rect.left; rect.left = 0; }
+    if (rect.top < 0) { rect.height += rect.top; rect.top = 0; }
+    if (rect.left + rect.width > 256) rect.width = 256 - rect.left;
+    if (rect.top + rect.height > 224) rect.height = 224 - rect.top;
+
+    if (rect.width <= 0 || rect.height <= 0 || color.a == 0) return;
+
+    for (int row = rect.top; row < rect.top + rect.height; row++) {
+        sf::Color* d = &softwareFrame[row * 256 + rect.left];
+        if (color.a == 255) fill(d, d + rect.width, color);
+        else for (int i = 0; i < rect.width; i++) blendPixel(d[i], color);
+    }
+}
+sf::Uint32 softwareFrameHash() {
+    lock_guard<mutex> gpu(gpuLock);
 
-            tile.setPosition(16.f * x - dx, 16.f * y - dy);
+    // FNV-1a over the frame's RGBA bytes
+    const sf::Uint8* bytes = reinterpret_cast<const sf::Uint8*>(softwareFrame.data());
+    sf::Uint32 hash = 2166136261u;
 
-            buffer.draw(tile);
+    for (size_t i = 0; i < softwareFrame.size() * 4; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+bool bakeAssets() {
+    // Packs every file in the asset folders, decoding PNGs, into a new Assets.pack. Written under another name first,
+    // so a running game never maps half a pack.
+    vector<fs::path> files;
+    error_code err;
+    for (const char* folder : assetFolders) {
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(folder, err)) {
+            if (entry.is_regular_file(err)) files.push_back(entry.path());
+        }
+    }
+    sort(files.begin(), files.end()); // same assets, same pack
+
+    string tempFilename = assetPackFilename + ".tmp";
+    ofstream out(tempFilename, ios::binary | ios::trunc);
+    PackHeader head = {};
+    out.write((const char*)&head, sizeof(head));
+
+    vector<PackEntry> entries;
+    uint64_t offset = sizeof(head);
+    size_t imageBytes = 0;
+    for (const fs::path& path : files) {
+        PackEntry entry = {};
+        string name = path.generic_string();
+        if (name.size() >= sizeof(entry.path)) {
+            cout << "\nSkipping " << name << ": path too long for the pack.";
+            continue;
+        }
+        memcpy(entry.path, name.c_str(), name.size());
+        entry.offset = offset;
+
+        vector<char> contents;
+        readFileBytes(name, contents);
+        entry.sourceHash = hashBytes(contents.data(), contents.size());
+        entry.sourceBytes = contents.size();
+
+        sf::Image image;
+        if (path.extension() == ".png" && !contents.empty() && image.loadFromMemory(contents.data(), contents.size())) {
+            entry.kind = packImage;
+            entry.width = image.getSize().x;
+            entry.height = image.getSize().y;
+            entry.bytes = (uint64_t)entry.width * entry.height * 4;
+            if (entry.bytes > 0) out.write((const char*)image.getPixelsPtr(), entry.bytes);
+            imageBytes += entry.bytes;
         }
+        else {
+            entry.kind = packFile;
+            entry.bytes = contents.size();
+            out.write(contents.data(), contents.size());
+        }
+
+        offset += entry.bytes;
+        entries.push_back(entry);
     }
 
+    head.entryCount = (uint32_t)entries.size();
+    head.entryBytes = sizeof(PackEntry);
+    head.indexOffset = offset;
+    memcpy(head.magic, packMagic, 4);
+    head.version = packVersion;
+    out.write((const char*)entries.data(), entries.size() * sizeof(PackEntry));
+    out.seekp(0);
+    out.write((const char*)&head, sizeof(head));
+    if (!out) {
+        cout << "Unable to write " << tempFilename << ".\n";
+        return false;
+    }
+    out.close();
+
+    fs::rename(tempFilename, assetPackFilename, err);
+    if (err) {
+        cout << "Unable to replace " << assetPackFilename << ": " << err.message() << "\n";
+        return false;
+    }
+    cout << "Baked " << entries.size() << " assets (" << imageBytes / 1024 << "K of pixels) into " << assetPackFilename << ".\n";
+    return true;
 }
-void drawTilemapScroll(sf::Texture tex) {
-    drawTilemapScroll(tex, 0);
+bool readTilemap(string filename, int tiles[64][64], sf::Vector2i& size) {
+    return readTilemap(filename, 0, tiles, size);
 }
-void drawText(int x, int y, string txt, sf::Color color) {
-    sf::Sprite text;
-    text.setTexture(font);
-    text.setColor(color);
+bool readTilemap(string filename, int layer, int tiles[64][64], sf::Vector2i& size) {
+    // PyxelEdit text: "key value" header lines in any order, then a "layer N" line before each layer's comma separated rows.
+    // The file is read into one buffer that's reused between calls, and numbers are parsed in place.
+    // Packed tilemaps are parsed straight out of the pack.
+    thread_local vector<char> text;
+    const char* start;
+    size_t bytes;
+
+    if (!assetPack.file(filename, start, bytes)) {
+        ifstream file(filename, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            cout << "\nUnable to open tilemap: " << filename;
+            return false;
+        }
+        text.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(text.data(), text.size());
+        start = text.data();
+        bytes = text.size();
+    }
+
+    const char* end = start + bytes;
+    const char* layerStart = nullptr;
+    int columns = -1, rows = -1;
+
+    auto keyValue = [&](const char* line, const char* lineEnd, const char* key, int& value) {
+        size_t length = strlen(key);
+        if ((size_t)(lineEnd - line) <= length || memcmp(line, key, length) != 0 || line[length] != ' ') return false;
+        from_chars(line + length + 1, lineEnd, value);
+        return true;
+    };
+
+    // Header, and where the wanted layer starts
+    for (const char* line = start; line < end;) {
+        const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+        if (!lineEnd) lineEnd = end;
 
-    int cx, cy;
-    unsigned char c;
+        int value = -1;
+        if (keyValue(line, lineEnd, "tileswide", value)) columns = value;
+        else if (keyValue(line, lineEnd, "tileshigh", value)) rows = value;
+        else if (keyValue(line, lineEnd, "layer", value) && value == layer && !layerStart) layerStart = lineEnd;
 
-    for(int i = 0; i < txt.length(); i++) {
-        c = txt[i] - 32;
-        cx = c % 16; cx *= 8;
-        cy = c / 16; cy *= 16;
+        line = lineEnd + 1;
+    }
+    if (columns <= 0 || rows <= 0 || !layerStart) {
+        cout << "\nWarning: " << filename << " has no " << (layerStart ? "size" : "layer " + to_string(layer)) << ".";
+        return false;
+    }
+    if (columns > 64 || rows > 64) cout << "\nWarning: " << filename << " is larger than 64x64, the rest is ignored.";
+
+    // Tile IDs, row by row (into a copy, so a bad file leaves the old tiles alone)
+    int parsed[64][64];
+    const char* p = layerStart;
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            while (p < end && (*p == ',' || *p == ' ' || *p == '\r' || *p == '\n' || *p == '\t')) p++;
+
+            int tile;
+            from_chars_result result = from_chars(p, end, tile);
+            if (result.ec != errc()) {
+                cout << "\nWarning: " << filename << " ends or has a bad tile at row " << y << ", column " << x << ".";
+                return false;
+            }
+            p = result.ptr;
+            if (x < 64 && y < 64) parsed[x][y] = tile;
+        }
+    }
 
-        text.setTextureRect(sf::IntRect(cx, cy, 8, 16));
-        text.setPosition((float)x, (float)y);
-        buffer.draw(text);
-        x += 8;
+    size = sf::Vector2i(min(columns, 64), min(rows, 64));
+    for (int x = 0; x < size.x; x++) memcpy(tiles[x], parsed[x], size.y * sizeof(int));
+    return true;
+}
+void setDrawOrder(int layer, int depth) {
+    drawLayer = layer;
+    drawDepth = depth;
+}
+void queueVertices(const sf::Texture* tex, const sf::Vertex* vertices, size_t count, sf::Vector2f offset) {
+    RenderCommand cmd;
+    cmd.layer = drawLayer;
+    cmd.depth = drawDepth;
+    cmd.order = (int)currentFrame.commands.size();
+    cmd.texture = tex;
+    cmd.first = currentFrame.vertices.size();
+    cmd.count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        currentFrame.vertices.push_back(vertices[i]);
+        currentFrame.vertices.back().position += offset;
     }
+    currentFrame.commands.push_back(cmd);
 }
-void drawText(int x, int y, string txt) {
-    drawText(x, y, txt, sf::Color::Black);
+void queueQuad(const sf::Texture* tex, sf::FloatRect dst, sf::IntRect src, sf::Color color) {
+    sf::Vertex quad[4] = {
+        sf::Vertex(sf::Vector2f(dst.left, dst.top), color, sf::Vector2f(src.left, src.top)),
+        sf::Vertex(sf::Vector2f(dst.left + dst.width, dst.top), color, sf::Vector2f(src.left + src.width, src.top)),
+        sf::Vertex(sf::Vector2f(dst.left + dst.width, dst.top + dst.height), color, sf::Vector2f(src.left + src.width, src.top + src.height)),
+        sf::Vertex(sf::Vector2f(dst.left, dst.top + dst.height), color, sf::Vector2f(src.left, src.top + src.height))
+    };
+    queueVertices(tex, quad, 4, sf::Vector2f(0.f, 0.f));
 }
-void loadTilemap(string filename, int layer) {
-    string line = " ";
-    stringstream linestream;
-    int columns, rows;
-
-    ifstream file(filename);
+void drawFrame(FrameSnapshot& frame) {
+    static vector<sf::Vertex> batch;
+    static int appliedFrameRate = -1;
+    static sf::Vector2u appliedSize;
+    const sf::Texture* batchTexture = nullptr;
+    const sf::Image* atlas = nullptr;
+    vector<RenderCommand>& commands = frame.commands;
+    vector<sf::Vertex>& vertices = frame.vertices;
+
+    unique_lock<mutex> gpu(gpuLock);
+
+    // Apply presentation settings
+    if (frame.frameRateLimit != appliedFrameRate) {
+        window->setFramerateLimit(frame.frameRateLimit);
+        window->setVerticalSyncEnabled(frame.frameRateLimit == 0); // Enable V-Sync if frame rate is uncapped
+        appliedFrameRate = frame.frameRateLimit;
+    }
+    if (frame.windowSize != appliedSize) {
+        window->setSize(frame.windowSize);
+        appliedSize = frame.windowSize;
+    }
+    buffer->setSmooth(frame.smooth);
+    if (softwareRender) textures.get(softwareFrameTex).setSmooth(frame.smooth);
 
-    if (file.is_open()) {
-        // get tilemap width
-        getline(file, line, ' ');
-        if (line != "tileswide") cout << "\nWarning: Unexpected tilemap format.";
-        getline(file, line);
-        columns = stoi(line);
+    if (frame.clear) {
+        if (softwareRender) fill(softwareFrame.begin(), softwareFrame.end(), frame.clearColor);
+        else buffer->clear(frame.clearColor);
+    }
 
-        // get tilemap height
-        getline(file, line, ' ');
-        if (line != "tileshigh") cout << "\nWarning: Unexpected tilemap format.";
-        getline(file, line);
-        rows = stoi(line);
+    // Draws at the same layer and depth keep their submission order, so overlaps come out the same every run;
+    // consecutive draws from one texture still share a batch
+    sort(commands.begin(), commands.end(), [](const RenderCommand& a, const RenderCommand& b) {
+        if (a.layer != b.layer) return a.layer < b.layer;
+        if (a.depth != b.depth) return a.depth < b.depth;
+        return a.order < b.order;
+    });
+
+    int calls = 0;
+    batch.clear();
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        const RenderCommand& cmd = commands[i];
+
+        // Rasterize each quad on the CPU
+        if (softwareRender) {
+            if (i == 0 || cmd.texture != commands[i - 1].texture) {
+                TextureHandle tex = textures.find(cmd.texture);
+                atlas = tex.id == -1 ? nullptr : &textures.image(tex);
+            }
+            if (cmd.texture != nullptr && atlas == nullptr) continue;
 
-        // Skip over extra lines
-        while (getline(file, line) && line != "layer 0");
+            for (size_t v = cmd.first; v + 3 < cmd.first + cmd.count; v += 4) {
+                const sf::Vertex& tl = vertices[v];
+                const sf::Vertex& br = vertices[v + 2];
+                int x = (int)floor(tl.position.x), y = (int)floor(tl.position.y);
+                int w = (int)(br.position.x - tl.position.x), h = (int)(br.position.y - tl.position.y);
 
-        // Read tile ID's
-        for (int y = 0; y < rows; y++) {
-            for (int x = 0; x < columns; x++) {
-                getline(file, line, ',');
-                tilemap[layer][x][y] = stoi(line);
+                if (atlas) softwareBlit(*atlas, sf::IntRect((int)tl.texCoords.x, (int)tl.texCoords.y, w, h), x, y, tl.color);
+                else softwareFill(sf::IntRect(x, y, w, h), tl.color);
             }
+            continue;
         }
 
-        file.close();
+        // Start a new batch when the texture changes
+        if (!batch.empty() && cmd.texture != batchTexture) {
+            buffer->draw(&batch[0], batch.size(), sf::Quads, batchTexture);
+            calls++;
+            batch.clear();
+        }
+
+        batchTexture = cmd.texture;
+        batch.insert(batch.end(), vertices.begin() + cmd.first, vertices.begin() + cmd.first + cmd.count);
+    }
+    if (!batch.empty()) {
+        buffer->draw(&batch[0], batch.size(), sf::Quads, batchTexture);
+        calls++;
+    }
+    drawCalls = calls;
+
+    // Present
+    if (softwareRender) {
+        textures.get(softwareFrameTex).update(reinterpret_cast<const sf::Uint8*>(softwareFrame.data()));
+        bufferObj.setTexture(textures.get(softwareFrameTex));
+    }
+    else {
+        buffer->display();
+        bufferObj.setTexture(buffer->getTexture());
+    }
+    window->draw(bufferObj);
+    if (frame.scanlines) window->draw(scanlineObj);
+    gpu.unlock();
+
+    window->display();
+    window->clear(sf::Color::Black);
+
+    static bool firstFrame = true;
+    if (firstFrame) {
+        cout << "\nFirst frame after " << startupClock.getElapsedTime().asMilliseconds() << " ms.";
+        firstFrame = false;
+    }
+}
+void resetFrame(FrameSnapshot& frame) {
+    frame.commands.clear();
+    frame.vertices.clear();
+    frame.clear = false;
+}
+void presentFrame() {
+    currentFrame.frameRateLimit = maxFrameRate;
+    currentFrame.smooth = blur;
+    currentFrame.scanlines = showScanlines;
+    currentFrame.windowSize = gfxWindowSize();
+
+    if (!renderThreadRunning) drawFrame(currentFrame);
+    else {
+        // Wait for the render thread to pick up the previous frame, then hand this one over
+        unique_lock<mutex> lock(frameLock);
+        frameSignal.wait(lock, [] { return !framePending; });
+        swap(currentFrame, pendingFrame);
+        framePending = true;
+        lock.unlock();
+        frameSignal.notify_all();
+    }
+
+    resetFrame(currentFrame);
+    setDrawOrder(bgLayer, 0);
+}
+void renderLoop() {
+    FrameSnapshot frame;
+    window->setActive(true);
+
+    while (true) {
+        {
+            unique_lock<mutex> lock(frameLock);
+            frameSignal.wait(lock, [] { return framePending || !renderThreadRunning; });
+            if (!framePending) break; // stopped
+            swap(frame, pendingFrame);
+            framePending = false;
+        }
+        frameSignal.notify_all();
+
+        drawFrame(frame);
+    }
+
+    window->setActive(false);
+}
+void startRenderThread() {
+    if (showDebugInfo) cout << "\nStarting render thread...";
+
+    window->setActive(false);
+    renderThreadRunning = true;
+    renderThread = thread(renderLoop);
+}
+void stopRenderThread() {
+    if (!renderThreadRunning) return;
+
+    {
+        lock_guard<mutex> lock(frameLock);
+        renderThreadRunning = false;
     }
-    else cout << "\nUnable to open tilemap: " << filename;
+    frameSignal.notify_all();
+    renderThread.join();
+
+    window->setActive(true);
+}
+void closeWindow() {
+    // The render thread must be done with the window first
+    stopRenderThread();
+    window->close();
+}
+void loadTilemap(string filename, int layer) {
+    if (readTilemap(filename, tilemap[layer], tilemapSize[layer])) buildTileMesh(layer);
 }
 void loadTilemap(string filename) {
     loadTilemap(filename, 0);
@@ -547,10 +2135,7 @@ void MapControls() {
         if (showDebugInfo) cout << "\n No joystick found to map.";
     }
 
-    buffer.clear(sf::Color::Black);
-
-    string line;
-    ifstream file("Text/Map Controls.txt");
+    clearBuffer(sf::Color::Black);
 
     // Skip Unavailable buttons
     if (inputTimer == 0 && sf::Keyboard::isKeyPressed(sf::Keyboard::Escape)) {
@@ -558,12 +2143,8 @@ void MapControls() {
         mappedButtons++;
     }
 
-    if (file.is_open()) {
-        for (int i = 0; i <= mappedButtons; i++) getline(file, line);
-        drawText(128 - 4 * (int)line.length(), 16, line, sf::Color::White);
-
-        file.close();
-    }
+    const string& line = strings.line("Text/Map Controls.txt", mappedButtons);
+    drawText(128 - 4 * (int)line.length(), 16, line, sf::Color::White);
 
     switch (mappedButtons) {
         // Directional inputs
@@ -693,7 +2274,6 @@ void loadGfxSettings() {
     if (showDebugInfo) cout << "\nReading graphics settings...";
     string line;
     string expectedLabels[] = { "Aspect_Ratio:", "Scale_Factor:", "Frame_Rate:", "Scanlines:", "CRT_Blur:" };
-    int xSize = 256, ySize = 224;
     int values[5];
 
     // Parse file
@@ -720,20 +2300,18 @@ void loadGfxSettings() {
     }
 
 
-    // Apply settings
-    ySize = 224 * scale / 100;
+    // Window size, frame rate, V-Sync and blur are applied when the next frame is drawn
+
+    if (showDebugInfo) cout << "Done.";
+}
+sf::Vector2u gfxWindowSize() {
+    int xSize = 256, ySize = 224 * scale / 100;
 
     if (aspectRatio == 0) xSize = 256 * scale / 100;
     if (aspectRatio == 1) xSize = ySize * 4 / 3;
     if (aspectRatio == 2) xSize = ySize * 16 / 9;
 
-    window.setSize(sf::Vector2u(xSize, ySize));
-    buffer.setSmooth(blur);
-
-    window.setFramerateLimit(maxFrameRate);
-    window.setVerticalSyncEnabled(maxFrameRate == 0); // Enable V-Sync if frame rate is uncapped
-
-    if (showDebugInfo) cout << "Done.";
+    return sf::Vector2u(xSize, ySize);
 }
 
 void savePlayerStatus() {
@@ -759,6 +2337,7 @@ void loadPlayerStatus() {
     string line;
     string expectedLabels[] = { "Chunk_X:", "Chunk_Y:", "Player_X:", "Player_Y:", "Camera_X:", "Camera_Y:", "Stamina:", "Max_Stamina:", "Health:", "Max_Health:", };
     float values[10];
+    int64_t chunkValues[2];
 
     ifstream file("Player.dat");
     if (file.is_open()) {
@@ -766,11 +2345,12 @@ void loadPlayerStatus() {
             getline(file, line, ' ');
             if (line != expectedLabels[i]) cout << "\nWarining: character data may not be formatted correctly (line " << i + 1 << ").";
             getline(file, line);
-            values[i] = stof(line);
+            if (i < 2) chunkValues[i] = stoll(line);
+            else values[i] = stof(line);
         }
 
-        chunk.x = values[0];
-        chunk.y = values[1];
+        chunk.x = chunkValues[0];
+        chunk.y = chunkValues[1];
         pPos.x = values[2];
         pPos.y = values[3];
         screenPos[0].x = values[4];
@@ -816,12 +2396,19 @@ void loadEnemies() {
     if (showDebugInfo) cout << "\n   " << numEnemies << " enemies loaded.";
 }
 void spawnEnemies() {
+    RandomStream rng(worldSeed, rngEnemies, ChunkCoord(0, 0));
+
     enemies.clear();
     for (int i = 0; i < numEnemies; i++) {
         enemies.push_back(Enemy());
         enemies[i].setId(i);
-        enemies[i].setChunk(rand() % mapSize, rand() % mapSize);
-        enemies[i].setPosition((rand() % 23) * 48 + 32, (rand() % 23) * 48 + 32);
+        // Draws are taken one per statement: argument evaluation order differs between compilers
+        int cx = rng(mapSize);
+        int cy = rng(mapSize);
+        int px = rng(23) * 48 + 32;
+        int py = rng(23) * 48 + 32;
+        enemies[i].setChunk(cx, cy);
+        enemies[i].setPosition(px, py);
     }
 }
 
@@ -832,27 +2419,27 @@ void movePlayer(float speed, int layer) {
     bool clrUp = true, clrDn = true, clrLt = true, clrRt = true;
 
     // move character Up / Down
-    if (pressed[up] && clrUp) pPos.y -= speed * frameScl;
-    if (pressed[dn] && clrDn) pPos.y += speed * frameScl;
+    if (pressed[up] && clrUp) pPos.y -= speed * simScl;
+    if (pressed[dn] && clrDn) pPos.y += speed * simScl;
 
-    if ((tilemap[layer][(int)(pPos.x + strictness) / 16][(int)(pPos.y - 8) / 16] >= solidWallId)
-        || (tilemap[layer][(int)(pPos.x - strictness) / 16][(int)(pPos.y - 8) / 16] >= solidWallId))
+    if ((tileAt(layer, pPos.x + strictness, pPos.y - 8) >= solidWallId)
+        || (tileAt(layer, pPos.x - strictness, pPos.y - 8) >= solidWallId))
         pPos.y = gridPosY * 16 + 8;
-    if ((tilemap[layer][(int)(pPos.x + strictness) / 16][(int)(pPos.y + 8) / 16] >= solidWallId)
-        || (tilemap[layer][(int)(pPos.x - strictness) / 16][(int)(pPos.y + 8) / 16] >= solidWallId))
+    if ((tileAt(layer, pPos.x + strictness, pPos.y + 8) >= solidWallId)
+        || (tileAt(layer, pPos.x - strictness, pPos.y + 8) >= solidWallId))
         pPos.y = gridPosY * 16 + 8;
 
     // Move Character Left / Right
-    if (pressed[lt] && clrLt) pPos.x -= speed * frameScl;
-    if (pressed[rt] && clrRt) pPos.x += speed * frameScl;
+    if (pressed[lt] && clrLt) pPos.x -= speed * simScl;
+    if (pressed[rt] && clrRt) pPos.x += speed * simScl;
 
     // push character out of wall
     if (!noClip) {
-        if ((tilemap[layer][(int)(pPos.x - 8) / 16][(int)(pPos.y + strictness) / 16] >= solidWallId)
-            || (tilemap[layer][(int)(pPos.x - 8) / 16][(int)(pPos.y - strictness) / 16] >= solidWallId))
+        if ((tileAt(layer, pPos.x - 8, pPos.y + strictness) >= solidWallId)
+            || (tileAt(layer, pPos.x - 8, pPos.y - strictness) >= solidWallId))
             pPos.x = gridPosX * 16 + 8;
-        if ((tilemap[layer][(int)(pPos.x + 6) / 16][(int)(pPos.y + strictness) / 16] >= solidWallId)
-            || (tilemap[layer][(int)(pPos.x + 6) / 16][(int)(pPos.y - strictness) / 16] >= solidWallId))
+        if ((tileAt(layer, pPos.x + 6, pPos.y + strictness) >= solidWallId)
+            || (tileAt(layer, pPos.x + 6, pPos.y - strictness) >= solidWallId))
             pPos.x = gridPosX * 16 + 10;
     }
 }
@@ -876,12 +2463,19 @@ void capStats() {
 void drawStatusBars() {
     capStats();
 
+    int prevHealth[16];
+    bool changed = false;
+
     for (int i = 0; i < 16; i++) {
+        prevHealth[i] = tilemap[3][i][0];
         if (i < health / 2) tilemap[3][i][0] = 1;
         else if (health - 1 == 2 * i)  tilemap[3][i][0] = 3;
         else if (i < maxHealth / 2) tilemap[3][i][0] = 2;
         else tilemap[3][i][0] = -1;
+        if (tilemap[3][i][0] != prevHealth[i]) changed = true;
     }
+    if (changed) buildTileMesh(3);
+    setDrawOrder(uiLayer, 0);
     drawTilemapStatic(ui, 3);
 
     // Health
@@ -891,7 +2485,8 @@ void drawStatusBars() {
     stam.setSize(sf::Vector2f(32 * stamina / maxStamina, 4));
     stam.setPosition(sf::Vector2f(24, 22));
     stam.setFillColor(sf::Color::Green);
-    buffer.draw(stam);
+    setDrawOrder(uiLayer, 1);
+    drawShape(stam);
 }
 
 void updateFrameTime() {
@@ -912,6 +2507,9 @@ void updateFrameTime() {
         avgFrameTime = 0;
         frUpdate = 0;
         frUpdateCount = 0;
+
+        // Refresh the profiler readout at the same pace as the FPS counter
+        if (showDebugInfo) updateProfileStats();
     }
 }
 void updateScreen() {
@@ -930,321 +2528,1152 @@ void updateScreen() {
         fpsBg.setFillColor(sf::Color(0, 0, 0, 127));
         fpsBg.setPosition(fpsStart);
 
-        buffer.draw(fpsBg);
+        setDrawOrder(overlayLayer, 0);
+        drawShape(fpsBg);
+        setDrawOrder(overlayLayer, 1);
         drawText(fpsStart.x, fpsStart.y, to_string((int)currentFrameRate) + " FPS", fpsCol);
+
+        drawProfiler();
+    }
+
+    // Update graphics
+    ProfileScope scope(profPresent);
+    presentFrame();
+}
+void update() {
+    {
+        ProfileScope scope(profInput);
+        readInput();
+    }
+    updateFrameTime();
+    updateScreen();
+    textures.uploadDecoded();
+    endProfileFrame();
+    if (frameCount % textCacheLife == 0) trimTextCache();
+}
+void endProfileFrame() {
+    // Sections only record frames they ran in, so menu frames don't drag the game's minimums to zero
+    for (int i = 0; i < numProfSections; i++) {
+        ProfileSection& sec = profile[i];
+        if (sec.hit) {
+            sec.samples[sec.next] = sec.frameTime / 1000.f;
+            sec.next = (sec.next + 1) % profWindow;
+            if (sec.count < profWindow) sec.count++;
+        }
+        sec.frameTime = 0;
+        sec.hit = false;
+    }
+
+    frameGraph[frameGraphNext] = frameTime;
+    frameGraphNext = (frameGraphNext + 1) % profWindow;
+}
+void updateProfileStats() {
+    float sorted[profWindow];
+
+    for (int i = 0; i < numProfSections; i++) {
+        ProfileSection& sec = profile[i];
+        if (sec.count == 0) continue;
+
+        float sum = 0;
+        for (int j = 0; j < sec.count; j++) {
+            sorted[j] = sec.samples[j];
+            sum += sec.samples[j];
+        }
+        sort(sorted, sorted + sec.count);
+
+        sec.minMs = sorted[0];
+        sec.avgMs = sum / sec.count;
+        sec.p99Ms = sorted[(sec.count - 1) * 99 / 100];
+    }
+}
+void drawProfiler() {
+    char line[40];
+
+    sf::RectangleShape bg(sf::Vector2f(208, 16 * (numProfSections + 1)));
+    bg.setFillColor(sf::Color(0, 0, 0, 127));
+    bg.setPosition(0.f, 16.f);
+    setDrawOrder(overlayLayer, 0);
+    drawShape(bg);
+
+    // Section table, sub-sections indented under their parent
+    setDrawOrder(overlayLayer, 1);
+    drawText(0, 16, "Section   min   avg   p99", sf::Color::White);
+    for (int i = 0; i < numProfSections; i++) {
+        ProfileSection& sec = profile[i];
+        string name = (sec.parent >= 0 ? " " : "") + sec.name;
+        snprintf(line, sizeof(line), "%-8s%6.2f%6.2f%6.2f", name.c_str(), sec.minMs, sec.avgMs, sec.p99Ms);
+        drawText(0, 32 + 16 * i, line, sec.count > 0 ? sf::Color::White : sf::Color(127, 127, 127));
+    }
+
+    // Frame time graph, oldest on the left; full height is twice the target frame time
+    float target = 1000.f / (maxFrameRate > 0 ? maxFrameRate : 60);
+    sf::FloatRect graph(8.f, 192.f, 2.f * profWindow, 32.f);
+
+    bg.setSize(sf::Vector2f(graph.width, graph.height));
+    bg.setPosition(graph.left, graph.top);
+    setDrawOrder(overlayLayer, 0);
+    drawShape(bg);
+
+    setDrawOrder(overlayLayer, 1);
+    for (int i = 0; i < profWindow; i++) {
+        float ms = frameGraph[(frameGraphNext + i) % profWindow];
+        float h = min(graph.height, graph.height * ms / (2 * target));
+        queueQuad(nullptr, sf::FloatRect(graph.left + 2 * i, graph.top + graph.height - h, 2.f, h), sf::IntRect(), ms > target * 1.05 ? sf::Color::Red : sf::Color::Green);
+    }
+    queueQuad(nullptr, sf::FloatRect(graph.left, graph.top + graph.height / 2, graph.width, 1.f), sf::IntRect(), sf::Color(255, 255, 255, 127));
+
+    // Chunk cache, top left
+    int hits, misses;
+    size_t bytes;
+    chunkCache.stats(hits, misses, bytes);
+    snprintf(line, sizeof(line), "Cache %dh %dm %dK", hits, misses, (int)(bytes >> 10));
+
+    bg.setSize(sf::Vector2f(8.f * strlen(line), 16.f));
+    bg.setPosition(0.f, 0.f);
+    setDrawOrder(overlayLayer, 0);
+    drawShape(bg);
+    setDrawOrder(overlayLayer, 1);
+    drawText(0, 0, line, sf::Color::White);
+
+    // Draw calls, top right
+    snprintf(line, sizeof(line), "Draws %d", (int)drawCalls);
+
+    bg.setSize(sf::Vector2f(8.f * strlen(line), 16.f));
+    bg.setPosition(256.f - bg.getSize().x, 0.f);
+    setDrawOrder(overlayLayer, 0);
+    drawShape(bg);
+    setDrawOrder(overlayLayer, 1);
+    drawText(256 - 8 * strlen(line), 0, line, sf::Color::White);
+}
+
+// Game Functions
+void drawHighlightBox(int x, int y, int width) {
+    sf::Sprite tile;
+    tile.setTexture(textures.get(menu));
+    tile.setColor(sf::Color(255, 255, 255, 64));
+
+    for(int row = 0; row < 3; row++) {
+        tile.setTextureRect(sf::IntRect(96 + row * 48, 32, 16, 16));
+        tile.setPosition(x * 16.f,(y + row) * 16.f);
+        drawSprite(tile);
+
+        for(int i = 1; i < width; i++) {
+            tile.setTextureRect(sf::IntRect(112 + row * 48, 32, 16, 16));
+            tile.setPosition((x + i) * 16.f,(y + row) * 16.f);
+            drawSprite(tile);
+        }
+
+        tile.setTextureRect(sf::IntRect(128 + row * 48, 32, 16, 16));
+        tile.setPosition((x + width) * 16.f,(y + row) * 16.f);
+        drawSprite(tile);
+    }
+}
+bool generateMap() {
+    // Runs on genThread: nothing here may draw. mapGenScreen shows progress from genPhase and genChunksDone.
+    // Returns false if cancelled before the previous map was touched, or if the new map couldn't be saved;
+    // once saving starts, cancelling is ignored and the run always finishes.
+
+    // Endless maps generate each chunk the first time it's needed
+    if (endlessMap) {
+        if (genCancel) return false;
+        beginGenPhase(4);
+        resetMapFolder();
+        return true;
+    }
+
+    // Preparing to generate map
+    TileGrid grid(mapSize, mapSize);
+    if (showDebugInfo) cout << "\n   " << grid.bytes() / 1024 << " KB of tiles.";
+
+    // Building walls
+    beginGenPhase(1);
+    forEachChunk([&](int cx, int cy) {
+        buildChunkWalls(grid.chunk(cx, cy), ChunkCoord(cx, cy));
+    }, true);
+    if (genCancel) return false;
+
+    // Cutting doorways
+    beginGenPhase(2);
+    forEachChunk([&](int cx, int cy) {
+        cutChunkDoors(grid.chunk(cx, cy), ChunkCoord(cx, cy));
+    }, true);
+    if (genCancel) return false;
+
+    // Updating map graphics
+    beginGenPhase(3);
+    forEachChunk([&](int cx, int cy) {
+        autotileChunk(grid.chunk(cx, cy));
+    }, true);
+    if (genCancel) return false;
+
+    // Saving map (the previous map is only replaced once the new one is ready, and from here on cancelling is ignored)
+    beginGenPhase(4);
+    resetMapFolder();
+    vector<ChunkCoord> coords((size_t)mapSize * mapSize);
+    vector<vector<uint8_t>> payloads(coords.size());
+    forEachChunk([&](int cx, int cy) {
+        TileId* walls = grid.chunk(cx, cy);
+        if (exportTextChunks) exportChunkText(chunkTextFilename(ChunkCoord(cx, cy)), walls);
+        coords[cy * mapSize + cx] = ChunkCoord(cx, cy);
+        payloads[cy * mapSize + cx] = encodeChunk(walls, chunkCodec);
+    }, false);
+    if (!world.write(coords, payloads)) { // one write for the whole map
+        if (showDebugInfo) cout << "\nWarning: unable to save the map to " << worldFilename << ".";
+        world.close(); // don't leave half a map behind
+        fs::remove_all("Map");
+        remove("Player.dat");
+        return false;
+    }
+    return true;
+}
+void beginGenPhase(int phase) {
+    genChunksDone = 0;
+    genPhase = phase;
+}
+void resetMapFolder() {
+    world.close();
+    fs::remove_all("Map");
+    fs::create_directory("Map");
+    world.create(worldFilename, worldHeader());
+}
+void startMapGen() {
+    clearChunkViews();
+
+    // Every chunk is generated from the world seed and its own coordinates, so a seed always reproduces the same map
+    if (!fixedSeed) {
+        random_device entropy;
+        worldSeed = ((uint64_t)entropy() << 32 | entropy()) ^ (uint64_t)time(NULL);
+    }
+    if (showDebugInfo) cout << "\nGenerating map from seed " << worldSeed << "...";
+
+    // Phase names
+    genText = strings.lines("Text/MapGen.txt");
+
+    genCancel = false;
+    genSaved = false;
+    genPhase = 0;
+    genChunksDone = 0;
+    genRunning = true;
+    genClock.restart();
+    genThread = thread([]() {
+        genSaved = generateMap();
+        genRunning = false;
+    });
+}
+void cancelMapGen() {
+    genCancel = true;
+    if (genThread.joinable()) genThread.join();
+}
+void mapGenScreen() {
+    clearBuffer(sf::Color::Black);
+
+    // Finished (or cancelled)
+    if (!genRunning) {
+        genThread.join();
+
+        if (!genSaved) {
+            if (showDebugInfo && genCancel) cout << "\nMap generation cancelled.";
+            screen = 2;
+            inputTimer = 250;
+            return;
+        }
+
+        chunk.x = chunk.y = mapSize / 2;
+        loadMapChunk(chunk);
+        screen = 9;
+
+        // Clear Prev. Player Stats
+        remove("Player.dat");
+        health = maxHealth;
+        stamina = maxStamina;
+        numEnemies = 5 + 5 * (mapSettings[2] + 1) * mapSize * mapSize;
+        cout << "\n" << numEnemies;
+        cout << "\n" << numEnemies / (mapSize * mapSize);
+        spawnEnemies();
+        return;
+    }
+
+    // Progress through the four chunk phases
+    int phase = genPhase;
+    float progress = 0;
+    if (phase > 0) progress = (phase - 1 + min(1.f, (float)genChunksDone / (mapSize * mapSize))) / 4;
+
+    string line = phase < (int)genText.size() ? genText[phase] : "";
+    drawText(128 - line.length() * 4, 16, line, sf::Color::White);
+
+    sf::RectangleShape bar(sf::Vector2f(192.f, 12.f));
+    bar.setPosition(32.f, 104.f);
+    bar.setFillColor(sf::Color(0, 0, 0, 0));
+    bar.setOutlineColor(sf::Color::White);
+    bar.setOutlineThickness(1);
+    drawShape(bar);
+
+    bar.setSize(sf::Vector2f(192.f * progress, 12.f));
+    bar.setFillColor(sf::Color::White);
+    bar.setOutlineThickness(0);
+    drawShape(bar);
+
+    // Estimate the rest from how long the part so far took
+    string status = to_string((int)(progress * 100)) + "%";
+    float elapsed = genClock.getElapsedTime().asSeconds();
+    if (progress > 0.02) status += "  ETA " + to_string((int)ceil(elapsed * (1 - progress) / progress)) + "s";
+    drawText(128 - status.length() * 4, 128, status, sf::Color::White);
+
+    // Cancel back to game setup, until the previous map starts being replaced
+    if (phase == 4) return;
+    if (genText.size() > 5) drawText(128 - genText[5].length() * 4, 192, genText[5], sf::Color(127, 127, 127));
+
+    if ((pressed[b] || pressed[slct]) && inputTimer == 0) {
+        genCancel = true;
+        inputTimer = 250;
+    }
+}
+void generateChunk(TileId* walls, ChunkCoord chunk) {
+    buildChunkWalls(walls, chunk);
+    cutChunkDoors(walls, chunk);
+    autotileChunk(walls);
+}
+void buildChunkWalls(TileId* walls, ChunkCoord chunk) {
+    RandomStream rng(worldSeed, rngRooms, chunk);
+    int x1, y1, x2, y2, tmp;
+
+    memset(walls, 0, sizeof(TileId) * 64 * 64);
+
+    // Perimeter Walls
+    for (int i = 0; i < 64; i++) {
+        walls[i] = 32;
+        walls[63 * 64 + i] = 32;
+        walls[i * 64] = 32;
+        walls[i * 64 + 63] = 32;
+    }
+
+    // Interior Walls
+    for (int i = 0; i < mapDensity; i++) {
+        x1 = rng(22) * 3;
+        y1 = rng(22) * 3;
+        x2 = rng(22) * 3;
+        y2 = rng(22) * 3;
+
+        if (x1 > x2) {
+            tmp = x2;
+            x2 = x1;
+            x1 = tmp;
+        }
+        if (y1 > y2) {
+            tmp = y2;
+            y2 = y1;
+            y1 = tmp;
+        }
+
+        for (int x = x1; x <= x2; x++) {
+            walls[y1 * 64 + x] = 32;
+            walls[y2 * 64 + x] = 32;
+        }
+        for (int y = y1; y <= y2; y++) {
+            walls[y * 64 + x1] = 32;
+            walls[y * 64 + x2] = 32;
+        }
+    }
+}
+void cutChunkDoors(TileId* walls, ChunkCoord chunk) {
+    // Perimeter Walls: each edge has its own stream, so the chunks on either side of it cut the same doors (draw i is door i)
+    RandomStream top(worldSeed, rngEdgeDoorsH, chunk), bottom(worldSeed, rngEdgeDoorsH, chunk + ChunkCoord(0, 1));
+    RandomStream left(worldSeed, rngEdgeDoorsV, chunk), right(worldSeed, rngEdgeDoorsV, chunk + ChunkCoord(1, 0));
+    auto door = [](uint32_t draw) { return (int)(draw % 100) < doorFreq; }; // signed, like the old rand() % 100
+
+    for (int i = 0; i < 21; i++) {
+        // top and bottom
+        if (door(top.at(i))) {
+            walls[i * 3 + 1] = 0;
+            walls[i * 3 + 2] = 0;
+        }
+        if (door(bottom.at(i))) {
+            walls[63 * 64 + i * 3 + 1] = 0;
+            walls[63 * 64 + i * 3 + 2] = 0;
+        }
+        // left and right
+        if (door(left.at(i))) {
+            walls[(i * 3 + 1) * 64] = 0;
+            walls[(i * 3 + 2) * 64] = 0;
+        }
+        if (door(right.at(i))) {
+            walls[(i * 3 + 1) * 64 + 63] = 0;
+            walls[(i * 3 + 2) * 64 + 63] = 0;
+        }
+    }
+
+    // Interior Walls: two draws (horizontal, vertical) per grid point
+    uint32_t draws[21 * 21 * 2];
+    RandomStream(worldSeed, rngDoors, chunk).fill(draws, 0, 21 * 21 * 2);
+    for (int i = 1; i < 21; i++) {
+        for (int j = 1; j < 21; j++) {
+            // horizontal
+            if (door(draws[(i * 21 + j) * 2])) {
+                walls[j * 3 * 64 + i * 3 + 1] = 0;
+                walls[j * 3 * 64 + i * 3 + 2] = 0;
+            }
+            // vertical
+            if (door(draws[(i * 21 + j) * 2 + 1])) {
+                walls[(j * 3 + 1) * 64 + i * 3] = 0;
+                walls[(j * 3 + 2) * 64 + i * 3] = 0;
+            }
+        }
+    }
+}
+void autotileChunk(TileId* walls) {
+    autotileRect(walls, sf::IntRect(0, 0, 64, 64));
+}
+void autotileRect(TileId* walls, sf::IntRect rect) {
+    // Swap wall tiles to form appropriate connections. Only tiles inside rect change, but they look at
+    // neighbours outside it, so edits and streamed chunks can be re-autotiled in place.
+    int left = max(rect.left, 0), right = min(rect.left + rect.width, 64);
+    int top = max(rect.top, 0), bottom = min(rect.top + rect.height, 64);
+    uint64_t solid[66] = { 0 }; // walls in rows top - 1 to bottom, one bit per column
+
+    for (int y = max(top - 1, 0); y < min(bottom + 1, 64); y++) solid[y - top + 1] = solidRow(walls + y * 64);
+
+    for (int y = top; y < bottom; y++) {
+        uint64_t row = solid[y - top + 1];
+        uint64_t l = row << 1, u = solid[y - top], r = row >> 1, d = solid[y - top + 2];
+        TileId* tiles = walls + y * 64;
+
+        for (int x = left; x < right; x++) {
+            if (!(row >> x & 1)) continue;
+            tiles[x] = wallTileLUT[(l >> x & 1) | (u >> x & 1) << 1 | (r >> x & 1) << 2 | (d >> x & 1) << 3];
+        }
+    }
+}
+uint64_t solidRow(const TileId* row) {
+    uint64_t bits = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // 16 tiles per compare: max(t, 15) == t exactly when t >= 15
+    const __m128i firstWall = _mm_set1_epi8(15);
+    for (int i = 0; i < 4; i++) {
+        __m128i tiles = _mm_loadu_si128((const __m128i*)(row + 16 * i));
+        __m128i isWall = _mm_cmpeq_epi8(_mm_max_epu8(tiles, firstWall), tiles);
+        bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(isWall) << (16 * i);
+    }
+#else
+    for (int x = 0; x < 64; x++) bits |= (uint64_t)(row[x] >= 15) << x;
+#endif
+
+    return bits;
+}
+void saveChunk(TileId* walls, ChunkCoord chunk) {
+    if (exportTextChunks) exportChunkText(chunkTextFilename(chunk), walls); // before the archive, so it isn't seen as an edit
+    if (!world.write({ chunk }, { encodeChunk(walls, world.header().codec) }) && showDebugInfo)
+        cout << "\nWarning: unable to save chunk (" << chunk.x << ", " << chunk.y << ") to " << worldFilename << ".";
+}
+bool readChunk(ChunkCoord chunk, TileId* walls) {
+    return world.read(chunk, walls);
+}
+vector<uint8_t> encodeChunk(const TileId* walls, uint8_t codec) {
+    ChunkHeader header;
+    memcpy(header.magic, chunkMagic, 4);
+    header.version = chunkVersion;
+    header.tileBytes = sizeof(TileId);
+    header.width = 64;
+    header.height = 64;
+    header.codec = codec;
+
+    vector<uint8_t> payload((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    if (codec == codecRunLZ) compressTiles(walls, payload);
+    else payload.insert(payload.end(), walls, walls + 64 * 64);
+    return payload;
+}
+bool decodeChunk(const uint8_t* payload, size_t bytes, TileId* walls) {
+    ChunkHeader header;
+    if (bytes < sizeof(header)) return false;
+    memcpy(&header, payload, sizeof(header));
+
+    if (memcmp(header.magic, chunkMagic, 4) != 0 || header.version != chunkVersion || header.tileBytes != sizeof(TileId)
+        || header.width != 64 || header.height != 64) return false;
+
+    payload += sizeof(header);
+    bytes -= sizeof(header);
+    switch (header.codec) {
+    case codecRaw:
+        if (bytes != sizeof(ChunkFile::tiles)) return false;
+        memcpy(walls, payload, bytes);
+        return true;
+    case codecRunLZ:
+        return decompressTiles(payload, bytes, walls);
+    default:
+        return false;
+    }
+}
+
+// Chunk codec: a stream of ops, each a control byte (top 2 bits the op, low 6 bits the length) then its data.
+//   0 literals: length + 1 bytes copied as-is
+//   1 run:      length + 4 copies of the next byte (floor and solid wall)
+//   2 match:    length + 4 bytes copied from a 2-byte offset back (repeated wall pieces and room edges)
+// A length field of 63 is followed by extension bytes that are added on, 255 meaning another byte follows.
+const int codecMinRun = 4;
+void writeCodecOp(vector<uint8_t>& out, int op, int length) {
+    out.push_back((uint8_t)(op << 6 | min(length, 63)));
+    if (length < 63) return;
+    for (length -= 63; length >= 255; length -= 255) out.push_back(255);
+    out.push_back((uint8_t)length);
+}
+void compressTiles(const TileId* walls, vector<uint8_t>& out) {
+    const int total = 64 * 64;
+    int16_t lastSeen[4096]; // last position of each 3-byte hash
+    fill(lastSeen, lastSeen + 4096, (int16_t)-1);
+    int literalStart = 0;
+
+    auto flushLiterals = [&](int end) {
+        while (literalStart < end) {
+            int count = min(end - literalStart, 64);
+            writeCodecOp(out, 0, count - 1);
+            out.insert(out.end(), walls + literalStart, walls + literalStart + count);
+            literalStart += count;
+        }
+    };
+
+    int i = 0;
+    while (i < total) {
+        // Runs first: most of a chunk is one tile repeated
+        int run = 1;
+        while (i + run < total && walls[i + run] == walls[i]) run++;
+        if (run >= codecMinRun) {
+            flushLiterals(i);
+            writeCodecOp(out, 1, run - codecMinRun);
+            out.push_back(walls[i]);
+            i += run;
+            literalStart = i;
+            continue;
+        }
+
+        // Then the rows above (rooms are mostly straight columns) or the last place these three bytes were seen
+        int match = 0, from = -1;
+        auto tryMatch = [&](int candidate) {
+            if (candidate < 0) return;
+            int length = 0;
+            while (i + length < total && walls[candidate + length] == walls[i + length]) length++;
+            if (length > match) {
+                match = length;
+                from = candidate;
+            }
+        };
+        for (int rows = 1; rows <= 3; rows++) tryMatch(i - 64 * rows);
+        if (i + 3 <= total) {
+            int hash = (walls[i] * 251 + walls[i + 1] * 31 + walls[i + 2]) & 4095;
+            tryMatch(lastSeen[hash]);
+            lastSeen[hash] = (int16_t)i;
+        }
+        if (match >= codecMinRun) {
+            flushLiterals(i);
+            writeCodecOp(out, 2, match - codecMinRun);
+            int offset = i - from;
+            out.push_back((uint8_t)offset);
+            out.push_back((uint8_t)(offset >> 8));
+            i += match;
+            literalStart = i;
+        }
+        else i++;
+    }
+    flushLiterals(total);
+}
+bool decompressTiles(const uint8_t* in, size_t bytes, TileId* walls) {
+    // Every length and offset is checked, so a damaged chunk fails instead of writing past the tiles
+    const uint8_t* end = in + bytes;
+    int pos = 0;
+    const int total = 64 * 64;
+
+    while (in < end) {
+        int op = *in >> 6, length = *in & 63;
+        in++;
+        if (length == 63) {
+            uint8_t extra;
+            do {
+                if (in >= end) return false;
+                extra = *in++;
+                length += extra;
+            } while (extra == 255 && length < total);
+        }
+
+        switch (op) {
+        case 0: // literals
+            length += 1;
+            if (length > total - pos || length > end - in) return false;
+            memcpy(walls + pos, in, length);
+            in += length;
+            break;
+        case 1: // run
+            length += codecMinRun;
+            if (length > total - pos || in >= end) return false;
+            memset(walls + pos, *in++, length);
+            break;
+        case 2: { // match, which may overlap what it's copying
+            length += codecMinRun;
+            if (length > total - pos || end - in < 2) return false;
+            int offset = in[0] | in[1] << 8;
+            in += 2;
+            if (offset == 0 || offset > pos) return false;
+            if (offset >= length) memcpy(walls + pos, walls + pos - offset, length);
+            else for (int i = 0; i < length; i++) walls[pos + i] = walls[pos - offset + i];
+            break;
+        }
+        default:
+            return false;
+        }
+        pos += length;
+    }
+    return pos == total;
+}
+bool readChunkBinary(string filename, TileId* walls) {
+    // Loose Map_x_y.chunk files, from before the world archive
+    ChunkFile data;
+    ifstream file(filename, ios::binary);
+    if (!file.read((char*)&data, sizeof(data))) return false;
+
+    if (!decodeChunk((const uint8_t*)&data, sizeof(data), walls)) {
+        cout << "\nWarning: " << filename << " is not a version " << chunkVersion << " chunk.";
+        return false;
+    }
+    return true;
+}
+void exportChunkText(string filename, TileId* walls) {
+    ofstream file(filename);
+    file << "tileswide 64\ntileshigh 64\ntilewidth 16\ntileheight 16\n\nlayer 0\n";
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            file << (int)walls[y * 64 + x] << ",";
+        }
+        file << "\n";
+    }
+}
+bool importChunkText(string filename, TileId* walls) {
+    int tiles[64][64];
+    sf::Vector2i size;
+
+    if (!readTilemap(filename, tiles, size)) return false;
+    if (size != sf::Vector2i(64, 64)) {
+        cout << "\nWarning: " << filename << " is " << size.x << "x" << size.y << " tiles, not a 64x64 chunk.";
+        return false;
+    }
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            if (tiles[x][y] < 0 || tiles[x][y] > 255) { // TileId is 8-bit
+                cout << "\nWarning: " << filename << " has an out of range tile (" << tiles[x][y] << ") at row " << y << ", column " << x << ".";
+                return false;
+            }
+            walls[y * 64 + x] = (TileId)tiles[x][y];
+        }
+    }
+    return true;
+}
+string chunkTextFilename(ChunkCoord chunk) {
+    return "Map/Map_" + to_string(chunk.x) + "_" + to_string(chunk.y) + ".dat";
+}
+bool chunkSaved(ChunkCoord chunk) {
+    return world.contains(chunk);
+}
+bool chunkInMap(ChunkCoord chunk) {
+    return endlessMap || (chunk.x >= 0 && chunk.y >= 0 && chunk.x < mapSize && chunk.y < mapSize);
+}
+ArchiveHeader worldHeader() {
+    ArchiveHeader header = {};
+    header.endless = endlessMap;
+    header.codec = chunkCodec;
+    header.seed = worldSeed;
+    header.size = mapSize;
+    header.density = mapDensity;
+    header.doorFreq = doorFreq;
+    return header;
+}
+bool loadWorldInfo() {
+    // World.dat held the settings before the world archive
+    string line;
+    string expectedLabels[] = { "Seed:", "Endless:", "Size:", "Density:", "Doors:" };
+    string values[5];
+
+    ifstream file("Map/World.dat");
+    if (!file.is_open()) return false;
+
+    for (int i = 0; i < 5; i++) {
+        getline(file, line, ' ');
+        if (line != expectedLabels[i]) cout << "\nWarining: world data may not be formatted correctly (line " << i + 1 << ").";
+        getline(file, values[i]);
+    }
+
+    worldSeed = stoull(values[0]);
+    endlessMap = stoi(values[1]);
+    mapSize = stoi(values[2]);
+    mapDensity = stoi(values[3]);
+    doorFreq = stoi(values[4]);
+    return true;
+}
+void forEachChunk(const function<void(int, int)>& work, bool cancellable) {
+    // Chunks only touch their own 64x64 region, so any thread can take any chunk without changing the result
+    int numChunks = mapSize * mapSize;
+    int numThreads = genThreads > 0 ? genThreads : max(1, (int)thread::hardware_concurrency());
+    numThreads = min(numThreads, numChunks);
+    atomic<int> nextChunk(0);
+
+    auto worker = [&]() {
+        for (int i = nextChunk++; i < numChunks && !(cancellable && genCancel); i = nextChunk++) {
+            if (showDebugInfo && numThreads == 1) cout << "\n     Chunk (" << i / mapSize << ", " << i % mapSize << ").";
+            work(i / mapSize, i % mapSize);
+            genChunksDone++;
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 1; t < numThreads; t++) workers.emplace_back(worker);
+    worker();
+    for (thread& t : workers) t.join();
+}
+void loadMap() {
+    if (showDebugInfo) cout << "\nLoading map...";
+    clearChunkViews();
+
+    if (world.open(worldFilename)) {
+        ArchiveHeader header = world.header();
+        worldSeed = header.seed;
+        endlessMap = header.endless;
+        mapSize = header.size;
+        mapDensity = header.density;
+        doorFreq = header.doorFreq;
+        importLooseChunks(false);
     }
+    else importLegacyMap();
 
-    // Update graphics
-    buffer.display();
-    bufferObj.setTexture(buffer.getTexture());
-    window.draw(bufferObj);
-    if (showScanlines) window.draw(scanlineObj);
-    window.display();
-    window.clear(sf::Color::Black);
+    if (showDebugInfo) cout << "\n   seed " << worldSeed << (endlessMap ? ", endless, " : ", " + to_string(mapSize) + " chunks, ") << world.chunkCount() << " saved.";
 }
-void update() {
-    readInput();
-    updateFrameTime();
-    updateScreen();
+bool parseChunkFilename(const fs::path& path, ChunkCoord& chunk) {
+    // Map_x_y.dat or Map_x_y.chunk
+    string name = path.stem().string(), ext = path.extension().string();
+    if (name.compare(0, 4, "Map_") != 0 || (ext != ".dat" && ext != ".chunk")) return false;
+
+    int64_t x, y;
+    const char* end = name.data() + name.size();
+    from_chars_result result = from_chars(name.data() + 4, end, x);
+    if (result.ec != errc() || result.ptr == end || *result.ptr != '_') return false;
+    result = from_chars(result.ptr + 1, end, y);
+    if (result.ec != errc() || result.ptr != end) return false;
+
+    chunk = ChunkCoord(x, y);
+    return true;
 }
+void importLooseChunks(bool legacyMap) {
+    // Chunk files next to the archive: text chunks edited since it was written, or every chunk of a map from before it.
+    // The newest copy of each chunk goes into the archive in one write.
+    struct LooseChunk {
+        fs::path path;
+        fs::file_time_type time;
+    };
+    unordered_map<ChunkCoord, LooseChunk, ChunkCoordHash> found;
+    error_code err;
+    fs::file_time_type archiveTime = fs::last_write_time(worldFilename, err);
+
+    for (const fs::directory_entry& entry : fs::directory_iterator("Map", err)) {
+        ChunkCoord chunk;
+        if (!parseChunkFilename(entry.path(), chunk)) continue;
+
+        fs::file_time_type time = entry.last_write_time(err);
+        if (!legacyMap && time <= archiveTime) continue;
+
+        auto it = found.find(chunk);
+        if (it == found.end() || time > it->second.time) found[chunk] = LooseChunk{ entry.path(), time };
+    }
+    if (found.empty()) return;
+
+    vector<ChunkCoord> chunks;
+    vector<vector<uint8_t>> payloads;
+    unordered_map<ChunkCoord, bool, ChunkCoordHash> rejected;
+    TileId walls[64 * 64];
+    uint8_t codec = world.header().codec;
+    for (auto& item : found) {
+        string filename = item.second.path.string();
+        if (showDebugInfo) cout << "\n   Importing " << filename;
+
+        bool read = item.second.path.extension() == ".dat" ? importChunkText(filename, walls) : readChunkBinary(filename, walls);
+        if (!read) {
+            rejected[item.first] = true;
+            continue;
+        }
+        chunks.push_back(item.first);
+        payloads.push_back(encodeChunk(walls, codec));
+    }
+    if (!world.write(chunks, payloads)) { // keep the old files to import again next time
+        if (showDebugInfo) cout << "\nWarning: unable to save imported chunks to " << worldFilename << ".";
+        return;
+    }
 
-// Game Functions
-void drawHighlightBox(int x, int y, int width) {
-    sf::Sprite tile;
-    tile.setTexture(menu);
-    tile.setColor(sf::Color(255, 255, 255, 64));
+    // Old maps only need their files until they're in the archive; text chunks are kept for editing,
+    // and so is every file of a chunk that failed to import
+    if (legacyMap) {
+        vector<fs::path> imported = { "Map/World.dat" };
+        for (const fs::directory_entry& entry : fs::directory_iterator("Map", err)) {
+            ChunkCoord chunk;
+            if (parseChunkFilename(entry.path(), chunk) && !rejected.count(chunk)) imported.push_back(entry.path());
+        }
+        for (const fs::path& path : imported) fs::remove(path, err);
+    }
+}
+void importLegacyMap() {
+    // Maps from before World.dat: fixed size, every chunk on disk
+    if (!loadWorldInfo()) {
+        endlessMap = false;
 
-    for(int row = 0; row < 3; row++) {
-        tile.setTextureRect(sf::IntRect(96 + row * 48, 32, 16, 16));
-        tile.setPosition(x * 16.f,(y + row) * 16.f);
-        buffer.draw(tile);
+        if (showDebugInfo) cout << "\n   checking size: ";
+        string filename;
+        bool sizeReached = false;
 
-        for(int i = 1; i < width; i++) {
-            tile.setTextureRect(sf::IntRect(112 + row * 48, 32, 16, 16));
-            tile.setPosition((x + i) * 16.f,(y + row) * 16.f);
-            buffer.draw(tile);
+        mapSize = 0;
+        while (!sizeReached) {
+            mapSize++;
+
+            filename = "Map/Map_" + to_string(mapSize) + "_" + to_string(mapSize) + ".dat";
+            if (showDebugInfo) cout << "\n     " << filename;
+
+            if (!fs::exists(filename)) sizeReached = true;
         }
 
-        tile.setTextureRect(sf::IntRect(128 + row * 48, 32, 16, 16));
-        tile.setPosition((x + width) * 16.f,(y + row) * 16.f);
-        buffer.draw(tile);
+        if (showDebugInfo) cout << "\n   map size: " << mapSize << " chunks.";
+        mapSize--;
     }
+
+    if (showDebugInfo) cout << "\n   Converting map to " << worldFilename;
+    if (!world.create(worldFilename, worldHeader())) return;
+    importLooseChunks(true);
 }
-void generateMap() {
-    // Clear previous map
-    fs::remove_all("Map");
+void loadMapChunk(ChunkCoord chunk) {
+    ProfileScope scope(profChunks);
 
-    // Prepare to Display Text From File
-    string line;
-    ifstream file("Text/MapGen.txt");
-    
-    // Preparing to generate map
-    {
-        buffer.clear(sf::Color::Black);
-        getline(file, line);
-        drawText(128 - line.length() * 4, 16, line, sf::Color::White);
-        update();
+    if (showDebugInfo) cout << "\nLoading Chunk: (" << chunk.x << ", " << chunk.y << ")";
+
+    // Views already streamed in are picked up as they are, anything else is loaded now
+    vector<ChunkCoord> wanted;
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) wanted.push_back(chunk + ChunkCoord(x - 1, y - 1));
     }
-    vector<vector<int>> walls(mapSize * 64, vector<int>(mapSize * 64, 0));
-    int x1, y1, x2, y2, tmp;
+    streamChunks(wanted);
 
-    // Building walls
     {
-        buffer.clear(sf::Color::Black);
-        getline(file, line);
-        drawText(128 - line.length() * 4, 16, line, sf::Color::White);
-        update();
-        for (int cx = 0; cx < mapSize; cx++) {
-            for (int cy = 0; cy < mapSize; cy++) {
-                if (showDebugInfo) cout << "\n     Chunk (" << cx << ", " << cy << ").";
-
-                // Perimeter Walls
-                for (int i = 0; i < 64; i++) {
-                    walls[i + 64 * cx][64 * cy] = 32;
-                    walls[i + 64 * cx][63 + 64 * cy] = 32;
-                    walls[64 * cx][i + 64 * cy] = 32;
-                    walls[63 + 64 * cx][i + 64 * cy] = 32;
-                }
-
-                // Interior Walls
-                for (int i = 0; i < mapDensity; i++) {
-                    x1 = rand() % 22 * 3;
-                    y1 = rand() % 22 * 3;
-                    x2 = rand() % 22 * 3;
-                    y2 = rand() % 22 * 3;
-
-                    if (x1 > x2) {
-                        tmp = x2;
-                        x2 = x1;
-                        x1 = tmp;
-                    }
-                    if (y1 > y2) {
-                        tmp = y2;
-                        y2 = y1;
-                        y1 = tmp;
-                    }
-
-                    for (int x = x1; x <= x2; x++) {
-                        walls[x + 64 * cx][y1 + 64 * cy] = 32;
-                        walls[x + 64 * cx][y2 + 64 * cy] = 32;
-                    }
-                    for (int y = y1; y <= y2; y++) {
-                        walls[x1 + 64 * cx][y + 64 * cy] = 32;
-                        walls[x2 + 64 * cx][y + 64 * cy] = 32;
-                    }
+        lock_guard<mutex> guard(streamLock);
+        for (int x = 0; x < 3; x++) {
+            for (int y = 0; y < 3; y++) {
+                for (int i = 0; i < chunkPoolSize; i++) {
+                    if (chunkPool[i].state != viewEmpty && chunkPool[i].chunk == chunk + ChunkCoord(x - 1, y - 1)) chunkSlot[x][y] = i;
                 }
             }
         }
     }
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) finishChunkView(chunkSlot[x][y]);
+    }
 
-    // Cutting doorways
-    {
-        buffer.clear(sf::Color::Black);
-        getline(file, line);
-        drawText(128 - line.length() * 4, 16, line, sf::Color::White);
-        update();
-        for (int cx = 0; cx <= mapSize; cx++) {
-            for (int cy = 0; cy <= mapSize; cy++) {
-                if (showDebugInfo) cout << "\n     Chunk (" << cx << ", " << cy << ").";
-
-                // Perimeter Walls
-                for (int i = 0; i < 21; i++) {
-                    // top and bottom
-                    if (rand() % 100 < doorFreq && cx < mapSize) {
-                        if (cy < mapSize) {
-                            walls[i * 3 + cx * 64 + 1][cy * 64] = 0;
-                            walls[i * 3 + cx * 64 + 2][cy * 64] = 0;
-                        }
-                        if (cy > 0) {
-                            walls[i * 3 + cx * 64 + 1][cy * 64 - 1] = 0;
-                            walls[i * 3 + cx * 64 + 2][cy * 64 - 1] = 0;
-
-                        }
-                    }
-                    // left and right
-                    if (rand() % 100 < doorFreq && cy < mapSize) {
-                        if (cx < mapSize) {
-                            walls[cx * 64][i * 3 + cy * 64 + 1] = 0;
-                            walls[cx * 64][i * 3 + cy * 64 + 2] = 0;
-                        }
-                        if (cx > 0) {
-                            walls[cx * 64 - 1][i * 3 + cy * 64 + 1] = 0;
-                            walls[cx * 64 - 1][i * 3 + cy * 64 + 2] = 0;
-                        }
-                    }
-                }
+    // Center chunk doubles as tilemap layers 0 & 1 (collision, and anything still drawn from the tilemap)
+    ChunkView& center = chunkPool[chunkSlot[1][1]];
+    if (!center.loaded) return;
 
-                // Interior Walls
-                if (cx < mapSize && cy < mapSize) {
-                    for (int i = 1; i < 21; i++) {
-                        for (int j = 1; j < 21; j++) {
-                            // horizontal
-                            if (rand() % 100 < doorFreq && cx < mapSize) {
-                                walls[i * 3 + cx * 64 + 1][j * 3 + cy * 64] = 0;
-                                walls[i * 3 + cx * 64 + 2][j * 3 + cy * 64] = 0;
-                            }
-                            // vertical
-                            if (rand() % 100 < doorFreq && cx < mapSize) {
-                                walls[i * 3 + cx * 64][j * 3 + cy * 64 + 1] = 0;
-                                walls[i * 3 + cx * 64][j * 3 + cy * 64 + 2] = 0;
-                            }
-                        }
-                    }
-                }
-            }
+    // Endless maps keep the chunks the player has actually been to
+    if (endlessMap && !chunkSaved(chunk)) queueChunkSave(center.walls, chunk);
+
+    // Both layers come straight from the view. Gameplay draws the views' pre-rendered layers, so no tile mesh is built here.
+    for (int x = 0; x < 64; x++) {
+        for (int y = 0; y < 64; y++) {
+            tilemap[0][x][y] = center.walls[y * 64 + x];
+            tilemap[1][x][y] = center.cosmetic[y * 64 + x];
         }
     }
+    tilemapSize[0] = tilemapSize[1] = sf::Vector2i(64, 64);
+}
+void loadChunkView(ChunkView& view, ChunkCoord chunk) {
+    // Runs on the stream thread, or on the main thread for a view that's needed before the stream thread got to it.
+    // view.chunk is already set, under streamLock, by streamChunks.
+    view.loaded = false;
+    if (!chunkInMap(chunk)) return;
+
+    if (chunkCache.get(chunk, view.walls, view.cosmetic)) {
+        view.loaded = true;
+        return;
+    }
 
-    // Updating map graphics
-    {
-        buffer.clear(sf::Color::Black);
-        getline(file, line);
-        drawText(128 - line.length() * 4, 16, line, sf::Color::White);
-        update();
+    if (showDebugInfo) cout << "\n   Loading neighbour (" << chunk.x << ", " << chunk.y << ")";
+    if (endlessMap && !chunkSaved(chunk)) {
+        // Not visited yet: regenerate it from the seed
+        generateChunk(view.walls, chunk);
+    }
+    else if (!readChunk(chunk, view.walls)) return;
 
-        int x1, x2, y1, y2;
-        unsigned char wallForm;
-
-        for (int cx = 0; cx < mapSize; cx++) {
-            for (int cy = 0; cy < mapSize; cy++) {
-                if (showDebugInfo) cout << "\n     Chunk (" << cx << ", " << cy << ").";
-
-                for (int i = 0; i < 64; i += 3) {
-                    for (int j = 0; j < 64; j++) {
-                        x1 = i + 64 * cx;
-                        x2 = j + 64 * cx;
-                        y1 = j + 64 * cy;
-                        y2 = i + 64 * cy;
-
-                        // Vertical walls
-                        if (walls[x1][y1] >= 15) {
-                            walls[x1][y1] = 64;
-                            wallForm = 0;
-
-                            if (i > 0 && walls[x1 - 1][y1] >= 15) wallForm |= 0b0001; // Left
-                            if (j > 0 && walls[x1][y1 - 1] >= 15) wallForm |= 0b0010; // Up
-                            if (i < 63 && walls[x1 + 1][y1] >= 15) wallForm |= 0b0100; // Right
-                            if (j < 63 && walls[x1][y1 + 1] >= 15) wallForm |= 0b1000; // Down
-
-                            switch (wallForm) /* Swap wall tiles to form appropriate connections */ {
-                            case 0b0000: walls[x1][y1] = 47; break;
-                            case 0b0001: walls[x1][y1] = 34; break;
-                            case 0b0010: walls[x1][y1] = 35; break;
-                            case 0b0011: walls[x1][y1] = 43; break;
-                            case 0b0100: walls[x1][y1] = 32; break;
-                            case 0b0101: walls[x1][y1] = 33; break;
-                            case 0b0110: walls[x1][y1] = 44; break;
-                            case 0b0111: walls[x1][y1] = 39; break;
-                            case 0b1000: walls[x1][y1] = 36; break;
-                            case 0b1001: walls[x1][y1] = 46; break;
-                            case 0b1010: walls[x1][y1] = 38; break;
-                            case 0b1011: walls[x1][y1] = 42; break;
-                            case 0b1100: walls[x1][y1] = 45; break;
-                            case 0b1101: walls[x1][y1] = 41; break;
-                            case 0b1110: walls[x1][y1] = 40; break;
-                            case 0b1111: walls[x1][y1] = 37; break;
-                            }
-                        }
-
-                        // Horizontal walls
-                        if (walls[x2][y2] >= 15) {
-                            walls[x2][y2] = 64;
-                            wallForm = 0;
-
-                            if (j >  0 && walls[x2 - 1][y2] >= 15) wallForm |= 0b0001; // Left
-                            if (i >  0 && walls[x2][y2 - 1] >= 15) wallForm |= 0b0010; // Up
-                            if (j < 63 && walls[x2 + 1][y2] >= 15) wallForm |= 0b0100; // Right
-                            if (i < 63 && walls[x2][y2 + 1] >= 15) wallForm |= 0b1000; // Down
-
-                            switch (wallForm) /* Swap wall tiles to form appropriate connections */ {
-                            case 0b0000: walls[x2][y2] = 47; break;
-                            case 0b0001: walls[x2][y2] = 34; break;
-                            case 0b0010: walls[x2][y2] = 35; break;
-                            case 0b0011: walls[x2][y2] = 43; break;
-                            case 0b0100: walls[x2][y2] = 32; break;
-                            case 0b0101: walls[x2][y2] = 33; break;
-                            case 0b0110: walls[x2][y2] = 44; break;
-                            case 0b0111: walls[x2][y2] = 39; break;
-                            case 0b1000: walls[x2][y2] = 36; break;
-                            case 0b1001: walls[x2][y2] = 46; break;
-                            case 0b1010: walls[x2][y2] = 38; break;
-                            case 0b1011: walls[x2][y2] = 42; break;
-                            case 0b1100: walls[x2][y2] = 45; break;
-                            case 0b1101: walls[x2][y2] = 41; break;
-                            case 0b1110: walls[x2][y2] = 40; break;
-                            case 0b1111: walls[x2][y2] = 37; break;
-                            }
-                         }
-                    }
-                }
+    for (int i = 0; i < 64 * 64; i++) view.cosmetic[i] = cosmeticTile(view.walls[i]);
+    chunkCache.put(chunk, view.walls, view.cosmetic);
+    view.loaded = true;
+}
+void renderChunkView(ChunkView& view) {
+    sf::VertexArray mesh(sf::Quads);
+    sf::RenderStates states(sf::BlendNone, sf::Transform::Identity, &textures.get(walls), nullptr); // tiles don't overlap, so copy texels as-is
+    ChunkTarget& target = chunkTargets[view.target];
+
+    lock_guard<mutex> gpu(gpuLock);
+
+    if (!target.layers[0]) {
+        for (unique_ptr<sf::RenderTexture>& layer : target.layers) {
+            layer = make_unique<sf::RenderTexture>();
+            layer->create(1024, 1024);
+        }
+    }
+
+    for (int layer = 0; layer < 2; layer++) {
+        mesh.clear();
+        for (int x = 0; x < 64; x++) {
+            for (int y = 0; y < 64; y++) {
+                appendTileQuad(mesh, layer == 0 ? view.walls[y * 64 + x] : view.cosmetic[y * 64 + x], 16.f * x, 16.f * y);
             }
         }
+
+        target.layers[layer]->clear(sf::Color::Transparent);
+        target.layers[layer]->draw(mesh, states);
+        target.layers[layer]->display();
+    }
+}
+void updateChunkTargets(sf::Vector2f camera) {
+    // Views on or near the screen keep their render target or get a free one, the rest give theirs back
+    sf::FloatRect near(camera.x - chunkTargetMargin, camera.y - chunkTargetMargin, 256.f + 2 * chunkTargetMargin, 224.f + 2 * chunkTargetMargin);
+    bool wanted[chunkPoolSize] = {};
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) {
+            int i = chunkSlot[x][y];
+            if (chunkPool[i].loaded && near.intersects(sf::FloatRect((x - 1) * 1024.f, (y - 1) * 1024.f, 1024.f, 1024.f))) wanted[i] = true;
+        }
+    }
+
+    bool used[chunkTargetCount] = {};
+    for (int i = 0; i < chunkPoolSize; i++) {
+        if (chunkPool[i].target == -1) continue;
+        if (wanted[i]) used[chunkPool[i].target] = true;
+        else chunkPool[i].target = -1;
     }
+    for (int i = 0; i < chunkPoolSize; i++) {
+        if (!wanted[i] || chunkPool[i].target != -1) continue;
+        int free = (int)(find(used, used + chunkTargetCount, false) - used);
+        if (free == chunkTargetCount) break;
+
+        used[free] = true;
+        chunkPool[i].target = free;
+        renderChunkView(chunkPool[i]);
+    }
+}
+void clearChunkViews() {
+    // Loads that haven't started are dropped, saves are let finish (the world may be about to close)
+    unique_lock<mutex> guard(streamLock);
+    streamJobs.erase(remove_if(streamJobs.begin(), streamJobs.end(), [](const StreamJob& job) { return job.view >= 0; }), streamJobs.end());
+    streamDone.wait(guard, [] { return streamJobs.empty() && !streamBusy; });
+
+    for (int i = 0; i < chunkPoolSize; i++) {
+        chunkPool[i].state = viewEmpty;
+        chunkPool[i].loaded = false;
+        chunkPool[i].target = -1;
+    }
+    chunkCache.clear(); // a different map may be loaded next
+}
+void startStreaming() {
+    streamRunning = true;
+    streamThread = thread(streamLoop);
+}
+void stopStreaming() {
+    if (!streamRunning) return;
 
-    // Saving map
     {
-        buffer.clear(sf::Color::Black);
-        getline(file, line);
-        drawText(128 - line.length() * 4, 16, line, sf::Color::White);
-        update();
-        fs::create_directory("Map");
+        lock_guard<mutex> guard(streamLock);
+        streamRunning = false;
+    }
+    streamWake.notify_all();
+    streamThread.join();
+}
+void streamLoop() {
+    unique_lock<mutex> guard(streamLock);
 
-        for (int cx = 0; cx < mapSize; cx++) {
-            for (int cy = 0; cy < mapSize; cy++) {
-                if (showDebugInfo) cout << "\nSaving Chunk (" << cx << ", " << cy << ").";
+    while (true) {
+        streamWake.wait(guard, [] { return !streamJobs.empty() || !streamRunning; });
+        if (streamJobs.empty()) break; // stopped, with every save written
 
-                stringstream filename;
-                filename << "Map/Map_" << cx << "_" << cy << ".dat";
+        StreamJob job = move(streamJobs.front());
+        streamJobs.pop_front();
+        streamBusy = true;
+        guard.unlock();
 
-                ofstream file;
-                file.open(filename.str());
-                file << "tileswide 64\ntileshigh 64\ntilewidth 16\ntileheight 16\n\nlayer 0\n";
-                for (int y = 0; y < 64; y++) {
-                    for (int x = 0; x < 64; x++) {
-                        file << walls[64 * cx + x][64 * cy + y] << ",";
-                    }
-                    file << "\n";
-                }
-            }
-        }
+        if (job.view >= 0) loadChunkView(chunkPool[job.view], job.chunk);
+        else saveChunk(job.walls.data(), job.chunk);
 
-        file.close();
+        guard.lock();
+        if (job.view >= 0) chunkPool[job.view].state = viewDecoded;
+        streamBusy = false;
+        streamDone.notify_all();
     }
 }
-void loadMap() {
-    if (showDebugInfo) cout << "\nLoading map...";
-
-    if (showDebugInfo) cout << "\n   checking size: ";
-    string filename;
-    bool sizeReached = false;
+void streamChunks(const vector<ChunkCoord>& wanted) {
+    // Gives each wanted chunk a view, reusing the ones wanted longest ago, and queues the new ones in order
+    unique_lock<mutex> guard(streamLock);
+    streamStamp++;
+
+    auto isWanted = [&](ChunkCoord target) { return find(wanted.begin(), wanted.end(), target) != wanted.end(); };
+
+    // Loads that haven't started and aren't wanted any more free their view
+    for (auto job = streamJobs.begin(); job != streamJobs.end();) {
+        if (job->view >= 0 && !isWanted(job->chunk)) {
+            chunkPool[job->view].state = viewEmpty;
+            job = streamJobs.erase(job);
+        }
+        else job++;
+    }
 
-    mapSize = 0;
-    while (!sizeReached) {
-        mapSize++;
+    // Stamp every view that's already there first, so none of them can be picked for a chunk that isn't
+    vector<ChunkCoord> missing;
+    for (const ChunkCoord& target : wanted) {
+        int found = -1;
+        for (int i = 0; i < chunkPoolSize; i++) {
+            if (chunkPool[i].state != viewEmpty && chunkPool[i].chunk == target) found = i;
+        }
+        if (found == -1) missing.push_back(target);
+        else chunkPool[found].lastWanted = streamStamp;
+    }
 
-        filename = "Map/Map_" + to_string(mapSize) + "_" + to_string(mapSize) + ".dat";
-        if (showDebugInfo) cout << "\n     " << filename;
+    for (const ChunkCoord& target : missing) {
+        int oldest = -1;
+        for (int i = 0; i < chunkPoolSize; i++) {
+            ChunkView& view = chunkPool[i];
+            if (view.state == viewEmpty || (view.state != viewQueued && view.lastWanted < streamStamp)) {
+                // Free views first, then the one wanted longest ago
+                bool better = oldest == -1 || (chunkPool[oldest].state != viewEmpty && (view.state == viewEmpty || view.lastWanted < chunkPool[oldest].lastWanted));
+                if (better) oldest = i;
+            }
+        }
+        if (oldest == -1) continue; // every view is busy, try again next step
+
+        ChunkView& view = chunkPool[oldest];
+        view.chunk = target;
+        view.loaded = false;
+        view.target = -1;
+        view.lastWanted = streamStamp;
+        if (chunkInMap(target)) {
+            view.state = viewQueued;
+            StreamJob job;
+            job.view = oldest;
+            job.chunk = target;
+            streamJobs.push_back(move(job));
+        }
+        else view.state = viewReady; // past the map's edge, nothing to load
+    }
 
-        if (!fs::exists(filename)) sizeReached = true;
+    guard.unlock();
+    streamWake.notify_all();
+}
+void updateChunkStreaming() {
+    ProfileScope scope(profChunks);
+
+    // The chunks around the player, then the column, row or corner past the edges they're heading for
+    sf::Vector2f heading = pPos - prevPPos;
+    int dx = 0, dy = 0;
+    if (pPos.x < prefetchAlways || (pPos.x < prefetchDistance && heading.x < 0)) dx = -1;
+    if (pPos.x >= 1024.f - prefetchAlways || (pPos.x >= 1024.f - prefetchDistance && heading.x > 0)) dx = 1;
+    if (pPos.y < prefetchAlways || (pPos.y < prefetchDistance && heading.y < 0)) dy = -1;
+    if (pPos.y >= 1024.f - prefetchAlways || (pPos.y >= 1024.f - prefetchDistance && heading.y > 0)) dy = 1;
+
+    vector<ChunkCoord> wanted;
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) wanted.push_back(chunk + ChunkCoord(x - 1, y - 1));
+    }
+    for (int i = -1; i <= 1; i++) {
+        if (dx != 0) wanted.push_back(chunk + ChunkCoord(2 * dx, i));
+        if (dy != 0) wanted.push_back(chunk + ChunkCoord(i, 2 * dy));
+    }
+    if (dx != 0 && dy != 0) wanted.push_back(chunk + ChunkCoord(2 * dx, 2 * dy));
+    streamChunks(wanted);
+
+    // Views the stream thread has finished are ready for the crossing; they're pre-rendered once they come near the screen
+    for (int i = 0; i < chunkPoolSize; i++) {
+        bool decoded;
+        {
+            lock_guard<mutex> guard(streamLock);
+            decoded = chunkPool[i].state == viewDecoded;
+        }
+        if (decoded) finishChunkView(i);
+    }
+}
+void finishChunkView(int i) {
+    // Makes view i ready to draw: waits for the stream thread if it's loading it, or loads it here if it hasn't started
+    ChunkView& view = chunkPool[i];
+    unique_lock<mutex> guard(streamLock);
+
+    auto job = find_if(streamJobs.begin(), streamJobs.end(), [&](const StreamJob& queued) { return queued.view == i; });
+    if (job != streamJobs.end()) {
+        streamJobs.erase(job);
+        guard.unlock();
+        loadChunkView(view, view.chunk);
+        guard.lock();
+        view.state = viewDecoded;
     }
+    else streamDone.wait(guard, [&] { return view.state != viewQueued; });
 
-    if (showDebugInfo) cout << "\n   map size: " << mapSize << " chunks.";
-    mapSize--;
+    if (view.state != viewDecoded) return;
+    view.state = viewReady;
 }
-void loadMapChunk(sf::Vector2i chunk) {
-    if (showDebugInfo) cout << "\nLoading Chunk: (" << chunk.x << ", " << chunk.y << ")";
-    stringstream filename;
-    filename << "Map/Map_" << chunk.x << "_" << chunk.y << ".dat";
-    loadTilemap(filename.str());
+void queueChunkSave(const TileId* walls, ChunkCoord chunk) {
+    StreamJob job;
+    job.chunk = chunk;
+    job.walls.assign(walls, walls + 64 * 64);
 
-    if (showDebugInfo) cout << "\nGenerating Cosmetic Wall layer";
-    for (int x = 0; x < 64; x++) {
-        for (int y = 0; y < 64; y++) {
-            if (tilemap[0][x][y] > 16) tilemap[1][x][y] = tilemap[0][x][y] - 16;
-            else tilemap[1][x][y] = 15;
+    {
+        lock_guard<mutex> guard(streamLock);
+        streamJobs.push_back(move(job));
+    }
+    streamWake.notify_all();
+}
+void drawChunkLayer(TextureHandle tex, int layer, sf::Vector2f camera) {
+    int dx = camera.x, dy = camera.y;
+
+    for (int x = 0; x < 3; x++) {
+        for (int y = 0; y < 3; y++) {
+            ChunkView& view = chunkPool[chunkSlot[x][y]];
+            if (!view.loaded) continue; // beyond the map's edge, leave black
+
+            // Chunk origin on screen, and the part of it that's visible
+            int ox = (x - 1) * 1024 - dx, oy = (y - 1) * 1024 - dy;
+            int left = max(0, -ox), top = max(0, -oy);
+            int right = min(1024, 256 - ox), bottom = min(1024, 224 - oy);
+            if (right <= left || bottom <= top) continue;
+
+            if (softwareRender) {
+                for (int tx = left / 16; tx <= (right - 1) / 16; tx++) {
+                    for (int ty = top / 16; ty <= (bottom - 1) / 16; ty++) {
+                        int tileID = layer == 0 ? view.walls[ty * 64 + tx] : view.cosmetic[ty * 64 + tx];
+                        queueQuad(&textures.get(tex), sf::FloatRect(ox + 16.f * tx, oy + 16.f * ty, 16.f, 16.f), sf::IntRect((tileID % 16) * 16, (tileID / 16) * 16, 16, 16), sf::Color::White);
+                    }
+                }
+                continue;
+            }
+
+            if (view.target == -1) continue; // updateChunkTargets gives every view on screen one, this is just in case
+            sf::Sprite part(chunkTargets[view.target].layers[layer]->getTexture(), sf::IntRect(left, top, right - left, bottom - top));
+            part.setPosition(ox + left, oy + top);
+            drawSprite(part);
         }
     }
 }
+int cosmeticTile(int wallTile) {
+    if (wallTile > 16) return wallTile - 16;
+    return 15;
+}
+int tileAt(int layer, float x, float y) {
+    int tx = (int)floor(x / 16), ty = (int)floor(y / 16);
+    if (tx >= 0 && ty >= 0 && tx < 64 && ty < 64) return tilemap[layer][tx][ty];
+    if (layer != 0 || tx < -64 || ty < -64 || tx >= 128 || ty >= 128) return -1;
+
+    // Walls just across the chunk's edge
+    int sx = tx < 0 ? 0 : (tx >= 64 ? 2 : 1);
+    int sy = ty < 0 ? 0 : (ty >= 64 ? 2 : 1);
+    ChunkView& view = chunkPool[chunkSlot[sx][sy]];
+    if (!view.loaded) return 0; // open floor beyond the map's edge
+
+    tx -= (sx - 1) * 64;
+    ty -= (sy - 1) * 64;
+    return view.walls[ty * 64 + tx];
+}
 
 // Game Screens
 void TitleScreen() {
@@ -1257,24 +3686,20 @@ void TitleScreen() {
 }
 void MainMenu() {
     drawTilemapStatic(titleScreen, 0);
+    setDrawOrder(bgLayer, 1);
     drawTilemapStatic(menu, 1);
 
-    // Load and display text
-    string line;
-    ifstream file("Text/Main Menu.txt");
-    if (file.is_open()) {
-        getline(file, line);
-        drawText(128 - 4 * (int)line.length(), 32, line);
-
-        for (int i = 0; i < 4; i++) {
-            getline(file, line);
-            drawText(100, 32 * i + 64, line);
-        }
+    // Display text
+    const vector<string>& text = strings.lines("Text/Main Menu.txt");
+    setDrawOrder(uiLayer, 0);
+    if (!text.empty()) {
+        drawText(128 - 4 * (int)text[0].length(), 32, text[0]);
 
-        file.close();
+        for (int i = 0; i < 4; i++) drawText(100, 32 * i + 64, strings.line("Text/Main Menu.txt", i + 1));
     }
 
     // Menu Visuals
+    setDrawOrder(uiLayer, 1);
     drawHighlightBox(4, 3 + selection * 2, 7);
 
     // Menu functionality
@@ -1296,7 +3721,7 @@ void MainMenu() {
             retScreen = 1;
             break;
         case 3: // Quit
-            window.close();
+            closeWindow();
             break;
         }
         inputTimer = 250;
@@ -1315,33 +3740,25 @@ void MainMenu() {
 }
 void Controls() {
     drawTilemapStatic(controls);
+    setDrawOrder(bgLayer, 1);
     drawTilemapStatic(menu, 1);
+    setDrawOrder(uiLayer, 0);
 
-    string line;
-    ifstream file("Text/Controls.txt");
-    if (file.is_open()) {
-        // Label buttons
-        getline(file, line);
-        drawText(16, 16, line, sf::Color::White);
-        getline(file, line);
-        drawText(112, 16, line, sf::Color::White);
-        getline(file, line);
-        drawText(192, 16, line, sf::Color::White);
-        getline(file, line);
-        drawText(128, 160, line, sf::Color::White);
-        getline(file, line);
-        drawText(208, 160, line, sf::Color::White);
+    const string text = "Text/Controls.txt";
 
-        // Options
-        getline(file, line);
-        drawText(32, 192, line);
-        getline(file, line);
-        drawText(175, 192, line);
+    // Label buttons
+    drawText(16, 16, strings.line(text, 0), sf::Color::White);
+    drawText(112, 16, strings.line(text, 1), sf::Color::White);
+    drawText(192, 16, strings.line(text, 2), sf::Color::White);
+    drawText(128, 160, strings.line(text, 3), sf::Color::White);
+    drawText(208, 160, strings.line(text, 4), sf::Color::White);
 
-        file.close();
-    }
+    // Options
+    drawText(32, 192, strings.line(text, 5));
+    drawText(175, 192, strings.line(text, 6));
 
     //menu display
+    setDrawOrder(uiLayer, 1);
     drawHighlightBox(selection * 9, 11, 9 - selection * 3);
 
     // Menu Functionality
@@ -1372,26 +3789,16 @@ void Controls() {
     }
 }
 void GfxSettings() {
-    int xSize = 256, ySize = 224;
-    string line, vsync;
-
     // Draw menu
     drawTilemapStatic(settings);
+    setDrawOrder(bgLayer, 1);
     drawTilemapStatic(menu, 1);
-    ifstream file("Text/Graphics Settings.txt");
-    if (file.is_open()) {
-        for (int i = 0; i < 5; i++) {
-            getline(file, line);
-            drawText(40, (i + 1) * 32, line, sf::Color::White);
-        }
-        getline(file, line);
-        drawText(32, 192, line);
-        getline(file, line);
-        drawText(176, 192, line);
-        getline(file, vsync);
-
-        file.close();
-    }
+    setDrawOrder(uiLayer, 0);
+    const string text = "Text/Graphics Settings.txt";
+    for (int i = 0; i < 5; i++) drawText(40, (i + 1) * 32, strings.line(text, i), sf::Color::White);
+    drawText(32, 192, strings.line(text, 5));
+    drawText(176, 192, strings.line(text, 6));
+    const string& vsync = strings.line(text, 7);
     
     // Text values
     drawText(160, 64, to_string(scale) + "%", sf::Color::White);
@@ -1428,14 +3835,6 @@ void GfxSettings() {
             if (aspectRatio > 2) aspectRatio = 0;
             inputTimer = 200;
         }
-
-        ySize = 224 * scale / 100;
-
-        if (aspectRatio == 0) xSize = 256 * scale / 100;
-        if (aspectRatio == 1) xSize = ySize * 4 / 3;
-        if (aspectRatio == 2) xSize = ySize * 16 / 9;
-
-        window.setSize(sf::Vector2u(xSize, ySize));
         break;
 
     case 1: // Scale
@@ -1450,14 +3849,6 @@ void GfxSettings() {
 
         if (scale < 100) blur = true;
         if (scale < 200) showScanlines = false;
-
-        ySize = 224 * scale / 100;
-
-        if (aspectRatio == 0) xSize = 256 * scale / 100;
-        if (aspectRatio == 1) xSize = ySize * 4 / 3;
-        if (aspectRatio == 2) xSize = ySize * 16 / 9;
-
-        window.setSize(sf::Vector2u(xSize, ySize));
         break;
 
     case 2: // Frame Rate
@@ -1470,9 +3861,7 @@ void GfxSettings() {
             inputTimer = 200;
         }
 
-        maxFrameRate = stdFrameRate[frameRateIndex];
-        window.setFramerateLimit(maxFrameRate);
-        window.setVerticalSyncEnabled(maxFrameRate == 0); // Enable V-Sync if frame rate is uncapped
+        maxFrameRate = stdFrameRate[frameRateIndex]; // V-Sync if uncapped, applied with the next frame
         break;
 
     case 3: // Scanlines
@@ -1517,10 +3906,10 @@ void GfxSettings() {
         break;
     case 7: selection = 0;
     }
-    buffer.setSmooth(blur);
 
     // Indicate selected options
     {
+        setDrawOrder(uiLayer, 1);
         if (selection < 6) drawHighlightBox(0, 1 + 2 * selection, 15 - 6 * (selection == 5));
         else drawHighlightBox(9, 11, 6);
 
@@ -1529,48 +3918,39 @@ void GfxSettings() {
         rect.setOutlineColor(sf::Color::White);
         rect.setFillColor(sf::Color(0, 0, 0, 0));
         rect.setOutlineThickness(1);
-        buffer.draw(rect);
+        drawShape(rect);
 
+        setDrawOrder(uiLayer, 2);
         sf::Sprite toggle;
-        toggle.setTexture(settings);
+        toggle.setTexture(textures.get(settings));
         toggle.setTextureRect(sf::IntRect(176, 0, 16, 16));
         toggle.setPosition(160.f + 14 * showScanlines, 128);
-        buffer.draw(toggle);
+        drawSprite(toggle);
         toggle.setPosition(160.f + 14 * blur, 160);
-        buffer.draw(toggle);
+        drawSprite(toggle);
     }
 }
 void gameSettings(){
-    buffer.clear();
-    string line;
-    ifstream file("Text/Game Setup.txt");
+    clearBuffer();
+    const string text = "Text/Game Setup.txt";
 
     // Check Map Existence
-    bool mapExists = fs::exists("Map/Map_0_0.dat");
+    bool mapExists = fs::exists(worldFilename) || fs::exists("Map/World.dat") || fs::exists("Map/Map_0_0.dat");
 
     
-    // Draw Text
-    getline(file, line);
-    if (mapExists) {
-        drawText(40, 32, line, sf::Color::White);
-        getline(file, line);
-    } else {
-        getline(file, line);
-        drawText(40, 32, line, sf::Color::White);
-    }
+    // Draw Text: a heading for each case, then each setting's label followed by one line per option
+    drawText(40, 32, strings.line(text, mapExists ? 0 : 1), sf::Color::White);
 
+    int n = 2;
     for (int i = 0; i < 4; i++) {
-        getline(file, line);
-        drawText(40, 80 + 16 * i, line, sf::Color::White);
+        drawText(40, 80 + 16 * i, strings.line(text, n++), sf::Color::White);
         if (i < 3) {
-            for (int n = 0; n <= mapSettings[i]; n++) getline(file, line);
-            drawText(168, 80 + 16 * i, line, sf::Color::White);
-            for (int n = 0; n < 3 - mapSettings[i] - 1; n++) getline(file, line);
+            drawText(168, 80 + 16 * i, strings.line(text, n + mapSettings[i]), sf::Color::White);
+            n += mapOptions[i];
         }
     }
 
-    getline(file, line);
-    drawText(40, 176, line, sf::Color::White);
+    drawText(40, 176, strings.line(text, n), sf::Color::White);
      
     // Input
     if (pressed[dn] && inputTimer == 0 && selection < 6) {
@@ -1592,7 +3972,7 @@ void gameSettings(){
         mapSettings[selection] --;
         inputTimer = 200;
     }
-    if (pressed[rt] && inputTimer == 0&& selection >= 0 && selection < 3 && mapSettings[selection] < 2) {
+    if (pressed[rt] && inputTimer == 0&& selection >= 0 && selection < 3 && mapSettings[selection] < mapOptions[selection] - 1) {
         mapSettings[selection] ++;
         inputTimer = 200;
     }
@@ -1616,26 +3996,16 @@ void gameSettings(){
 
             break;
         case 6: // New Map
-            mapSize = 7 + 10 * mapSettings[0];
+            endlessMap = mapSettings[0] == 3;
+            mapSize = endlessMap ? 7 : 7 + 10 * mapSettings[0]; // endless maps start in a 7x7 area, where enemies spawn
             mapDensity = 20 + 5 * mapSettings[1];
             doorFreq = 35 - 5 * mapSettings[2];
 
             pPos = { 512.f, 512.f };
             screenPos[0] = { 385, 400 };
 
-            generateMap();
-            chunk.x = chunk.y = mapSize / 2;
-            loadMapChunk(chunk);
-            screen = 9;
-
-            // Clear Prev. Player Stats
-            remove("Player.dat");
-            health = maxHealth;
-            stamina = maxStamina;
-            numEnemies = 5 + 5 * (mapSettings[2] + 1) * mapSize * mapSize;
-            cout << "\n" << numEnemies;
-            cout << "\n" << numEnemies / (mapSize * mapSize);
-            spawnEnemies();
+            startMapGen();
+            screen = 3;
 
             break;
         }
@@ -1644,17 +4014,15 @@ void gameSettings(){
     }
 
     // User Feedback
+    setDrawOrder(uiLayer, 1);
     drawHighlightBox(1, 4 + selection, 13);
 }
 void introText() {
-    buffer.clear();
+    clearBuffer();
 
-    stringstream filename;
-    string line;
     int lineX, lineY;
 
-    filename << "Text/Intro Text p" << textPhase << ".txt";
-    ifstream file(filename.str());
+    const vector<string>& text = strings.lines("Text/Intro Text p" + to_string(textPhase) + ".txt");
 
     if (textPhase == 1) {
         lineX = 8;
@@ -1665,7 +4033,7 @@ void introText() {
         lineY = 64;
     }
 
-    while (getline(file, line)) {
+    for (const string& line : text) {
         if (textPhase == 2) lineX = 128 - 4 * line.length();
         drawText(lineX, lineY, line, sf::Color::White);
         lineY += 16;
@@ -1678,25 +4046,20 @@ void introText() {
     if (textPhase >= 3) screen++;
 }
 void pauseMenu() {
-    loadTilemap("Tiles/Pause Menu.txt", 1);
+    setDrawOrder(bgLayer, 1);
     drawTilemapStatic(menu, 1);
 
-    // Load and display text
-    string line;
-    ifstream file("Text/Pause Menu.txt");
-    if (file.is_open()) {
-        getline(file, line);
-        drawText(128 - 4 * (int)line.length(), 32, line);
-
-        for (int i = 0; i < 4; i++) {
-            getline(file, line);
-            drawText(100, 32 * i + 64, line);
-        }
+    // Display text
+    const vector<string>& text = strings.lines("Text/Pause Menu.txt");
+    setDrawOrder(uiLayer, 0);
+    if (!text.empty()) {
+        drawText(128 - 4 * (int)text[0].length(), 32, text[0]);
 
-        file.close();
+        for (int i = 0; i < 4; i++) drawText(100, 32 * i + 64, strings.line("Text/Pause Menu.txt", i + 1));
     }
 
     // Menu Visuals
+    setDrawOrder(uiLayer, 1);
     drawHighlightBox(4, 3 + selection * 2, 7);
 
     // Menu functionality
@@ -1737,24 +4100,34 @@ void pauseMenu() {
     }
 }
 void mainGame() {
-    buffer.clear();
+    clearBuffer();
 
-    // Move player
-    speed = moveSpeed;
-    if (pressed[b]) {
-        if (stamina > 0) speed = moveSpeed * 2.5;
-        stamina --;
+    // Gameplay sprites pick up their textures on first use, by which time they have usually decoded behind the menus
+    if (playerObj.getTexture() == nullptr) {
+        playerObj.setTexture(textures.get(player));
+        enemyObj.setTexture(textures.get(enemy));
     }
-    else {
-        stamina += 0.1;
-    }
-    movePlayer(speed);
 
-    // Enemy Behavior
-    for (int i = 0; i < numEnemies; i++) {
-        enemies[i].damagePlayer();
-        enemies[i].chasePlayer();
+    // Coming back from another screen: don't interpolate from stale positions or catch up on time spent in menus
+    if (lastGameFrame != frameCount - 1) {
+        simAccumulator = 0;
+        prevPPos = pPos;
+        prevScreenPos = screenPos[0];
+        for (int i = 0; i < numEnemies; i++) enemies[i].storePosition();
     }
+    lastGameFrame = frameCount;
+
+    // Run the simulation at a fixed rate, independent of frame rate
+    simAccumulator += frameTime;
+    if (simAccumulator > maxSimLag) simAccumulator = maxSimLag;
+    if (simAccumulator >= simStep) {
+        ProfileScope scope(profSim);
+        while (simAccumulator >= simStep && screen == 10) {
+            stepGame();
+            simAccumulator -= simStep;
+        }
+    }
+    simAlpha = simAccumulator / simStep;
 
     // Debug
     if (sf::Keyboard::isKeyPressed(sf::Keyboard::Equal) && inputTimer == 0) {
@@ -1766,99 +4139,154 @@ void mainGame() {
         inputTimer = 200;
     }
 
+    // Interpolate between the last two simulation steps
+    sf::Vector2f camera = interpolate(prevScreenPos, screenPos[0], simAlpha);
+
+    // Render graphics
+    {
+        ProfileScope scope(profTiles);
+        if (!softwareRender) updateChunkTargets(camera);
+        setDrawOrder(bgLayer, 0);
+        drawChunkLayer(walls, 0, camera);
+    }
+    {
+        ProfileScope scope(profEntities);
+        playerObj.setPosition(interpolate(prevPPos, pPos, simAlpha) + chunkOffset - camera);
+        for (int i = 0; i < numEnemies; i++) {
+            enemies[i].draw(camera);
+
+        }
+        setDrawOrder(entityLayer, (int)pPos.y);
+        drawSprite(playerObj);
+    }
+    {
+        ProfileScope scope(profTiles);
+        setDrawOrder(fgLayer, 0);
+        drawChunkLayer(walls, 1, camera + sf::Vector2f(0.f, 16.f));
+    }
+
+    // Screen effects
+    {
+        ProfileScope scope(profVignette);
+        setDrawOrder(effectLayer, 0);
+        vignette();
+    }
+
+    // UI
+    {
+        ProfileScope scope(profUI);
+        drawStatusBars();
+    }
+
+    // Pause Menu
+    if ((pressed[start] || pressed[slct]) && inputTimer == 0) {
+        loadTilemap("Tiles/Pause Menu.txt", 1);
+        screen = 15;
+        inputTimer = 250;
+        selection = 0;
+    }
+}
+void stepGame() {
+    // Remember where everything was for interpolation
+    prevPPos = pPos;
+    prevScreenPos = screenPos[0];
+    for (int i = 0; i < numEnemies; i++) enemies[i].storePosition();
+
+    // Move player
+    {
+        ProfileScope scope(profPlayer);
+        speed = moveSpeed;
+        if (pressed[b]) {
+            if (stamina > 0) speed = moveSpeed * 2.5;
+            stamina -= simScl;
+        }
+        else {
+            stamina += 0.1 * simScl;
+        }
+        movePlayer(speed);
+    }
+
+    // Enemy Behavior
+    {
+        ProfileScope scope(profEnemies);
+        for (int i = 0; i < numEnemies; i++) {
+            enemies[i].damagePlayer();
+            enemies[i].chasePlayer();
+        }
+    }
+
     // Scroll screen
-    if (playerObj.getPosition().x > 192) screenPos[0].x += speed * frameScl;
-    if (playerObj.getPosition().x < 64) screenPos[0].x -= speed * frameScl;
-    if (playerObj.getPosition().y > 144) screenPos[0].y += speed * frameScl;
-    if (playerObj.getPosition().y < 64) screenPos[0].y -= speed * frameScl;
-    // Scroll cosmetic layer
-    screenPos[1].x = screenPos[0].x;
-    screenPos[1].y = screenPos[0].y + 16;
-
-    // Load chunk upon reaching map's edge
-    if (pPos.x <= 8.f) {
+    sf::Vector2f onScreen = pPos + chunkOffset - screenPos[0];
+    if (onScreen.x > 192) screenPos[0].x += speed * simScl;
+    if (onScreen.x < 64) screenPos[0].x -= speed * simScl;
+    if (onScreen.y > 144) screenPos[0].y += speed * simScl;
+    if (onScreen.y < 64) screenPos[0].y -= speed * simScl;
+
+    // Load chunk upon crossing into a neighbouring chunk (neighbours are already on screen, so shift by exactly one chunk)
+    sf::Vector2f shift(0.f, 0.f);
+    if (pPos.x < 0.f) {
         chunk.x--;
-        if (chunk.x < 0) {
+        if (!chunkInMap(chunk)) {
             screen = 20; // Victory
             inputTimer = 250;
         }
         else {
             loadMapChunk(chunk);
-            pPos.x = 1015;
-            screenPos[0].x += 1015;
+            shift.x = 1024;
         }
     }
-    if (pPos.x >= 1016.f) {
+    if (pPos.x >= 1024.f) {
         chunk.x++;
-        if (chunk.x >= mapSize) {
+        if (!chunkInMap(chunk)) {
             screen = 20; // Victory
             inputTimer = 250;
         }
         else {
             loadMapChunk(chunk);
-            pPos.x = 9;
-            screenPos[0].x -= 1015;
+            shift.x = -1024;
         }
     }
-    if (pPos.y <= 8.f) {
+    if (pPos.y < 0.f) {
         chunk.y--;
-        if (chunk.y < 0) {
+        if (!chunkInMap(chunk)) {
             screen = 20; // Victory
             inputTimer = 250;
         }
         else {
             loadMapChunk(chunk);
-            pPos.y = 1015;
-            screenPos[0].y += 1015;
+            shift.y = 1024;
         }
     }
-    if (pPos.y >= 1016.f) {
+    if (pPos.y >= 1024.f) {
         chunk.y++;
-        if (chunk.y >= mapSize) {
+        if (!chunkInMap(chunk)) {
             screen = 20; // Victory
             inputTimer = 250;
         }
         else {
             loadMapChunk(chunk);
-            pPos.y = 9;
-            screenPos[0].y -= 1015;
+            shift.y = -1024;
         }
     }
+    pPos += shift;
+    screenPos[0] += shift;
+    prevPPos += shift;
+    prevScreenPos += shift;
 
-    // Render graphics
-    drawTilemapScroll(walls);
-    playerObj.setPosition(pPos + chunkOffset - screenPos[0]);
-    for (int i = 0; i < numEnemies; i++) {
-        enemies[i].draw();
-
-    }
-    buffer.draw(playerObj);
-    drawTilemapScroll(walls, 1);
-
-    // Screen effects
-    vignette();
-
-    // UI
-    drawStatusBars();
-
-    // Pause Menu
-    if ((pressed[start] || pressed[slct]) && inputTimer == 0) {
-        screen = 15;
-        inputTimer = 250;
-        selection = 0;
-    }
+    updateChunkStreaming();
+}
+sf::Vector2f interpolate(sf::Vector2f from, sf::Vector2f to, float t) {
+    return from + (to - from) * t;
 }
 
 // Game Over Screens
 void victory() {
-    string line;
-    ifstream file("Text/Victory Message.txt");
-    buffer.clear(sf::Color::Cyan);
+    clearBuffer(sf::Color::Cyan);
     int x, y = 96;
     bool cont = false;
 
     // Graphics
-    while (getline(file, line)) {
+    for (const string& line : strings.lines("Text/Victory Message.txt")) {
         x = 128 - 4 * line.length();
         drawText(x, y, line, sf::Color::Black);
         y += 16;
@@ -1878,9 +4306,7 @@ void victory() {
     }
 }
 void death() {
-    string line;
-    ifstream file("Text/Death Message.txt");
-    buffer.clear(sf::Color::Black);
+    clearBuffer(sf::Color::Black);
     int x;
     bool cont = false;
 
@@ -1889,7 +4315,7 @@ void death() {
     remove("Player.dat");
 
     // Graphics
-    getline(file, line);
+    const string& line = strings.line("Text/Death Message.txt", 0);
     x = 128 - 4 * line.length();
     drawText(x, 104, line, sf::Color::Red);
 
@@ -1910,17 +4336,50 @@ void death() {
 
 // Screen effects
 void vignette() {
-    sf::CircleShape circ;
-    circ.setFillColor(sf::Color(0, 0, 0, 0));
-    circ.setOutlineColor(sf::Color(0, 0, 0, vignetteIntens * vignetteStep));
+    static int builtFov = -1, builtStep = -1, builtIntens = -1;
+
+    // Only rebuild the mask when its settings change
+    if (fov != builtFov || vignetteStep != builtStep || vignetteIntens != builtIntens) {
+        buildVignette();
+        builtFov = fov;
+        builtStep = vignetteStep;
+        builtIntens = vignetteIntens;
+    }
 
     sf::Vector2f center = playerObj.getPosition() + sf::Vector2f(8.f, 16.f);
+    vignetteObj.setPosition(center - sf::Vector2f(256.f, 256.f));
+    drawSprite(vignetteObj);
+}
+void buildVignette() {
+    // Same falloff as stacking a ring (inner radius i, outer radius 255) for every i from fov to 172 in steps of vignetteStep
+    const int size = 512;
+    float ringAlpha = vignetteIntens * vignetteStep / 255.f;
+    float alpha[256];
+    sf::Image mask;
+
+    if (showDebugInfo) cout << "\nBuilding vignette...";
+
+    for (int r = 0; r < 256; r++) {
+        int rings = 0;
+        if (r >= fov && r < 255 && fov < 172) rings = (min(r, 171) - fov) / vignetteStep + 1;
+        alpha[r] = 255.f * (1.f - pow(1.f - ringAlpha, rings));
+    }
+
+    mask.create(size, size, sf::Color::Transparent);
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            float dx = x + 0.5f - size / 2, dy = y + 0.5f - size / 2;
+            int r = (int)sqrt(dx * dx + dy * dy);
+            if (r < 256) mask.setPixel(x, y, sf::Color(0, 0, 0, (sf::Uint8)alpha[r]));
+        }
+    }
 
-    for (int i = fov; i < 172; i += vignetteStep) {
-        circ.setPosition(center - sf::Vector2f(i, i));
-        circ.setRadius(i);
-        circ.setOutlineThickness(255 - i);
-        buffer.draw(circ);
+    {
+        lock_guard<mutex> gpu(gpuLock);
+        textures.update(vignetteMask, mask);
     }
+    vignetteObj.setTexture(textures.get(vignetteMask), true);
+
+    if (showDebugInfo) cout << "done.";
 }
 